@@ -1,6 +1,7 @@
 #include "spiceapi/connection.h"
 #include "spiceapi/wrappers.h"
 #include "smx/smx_wrapper.h"
+#include "connection_set.h"
 #include "lights_utils.h"
 #include "input_utils.h"
 #include "overlay_utils.h"
@@ -28,6 +29,10 @@ using namespace std;
 const string kP1CardArg = "p1card";
 const string kP2CardArg = "p2card";
 const string kOpacityArg = "opacity";
+const string kInputRefreshArg = "inputrefresh";
+const string kApiSocketArg = "apisocket";
+const string kCaptureArg = "capture";
+const string kProxyArg = "proxy";
 
 // Forward function declarations
 void ParseArgs();
@@ -36,7 +41,6 @@ void CleanupTimers();
 void SmxOnLog(const char* log);
 void WaitForConnection();
 void CALLBACK ThirtyHzTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
-void CALLBACK InputTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
 void CALLBACK ConnectivityCheckTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
 void CALLBACK WindowPosTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
 
@@ -49,21 +53,30 @@ const int kInputsUpdateIntervalMs = 1;
 const int kSetWindowPosIntervalMs = 5000;
 // We check for SpiceAPI connections during runtime every 3 seconds
 const int kConnectionCheckIntervalMs = 3000;
-
-// Our connection object for communication with SpiceAPI
-Connection con("localhost", 1337, "spicemaniax");
+// How long to wait for the first connection attempt before telling the user we're waiting on SpiceAPI
+const int kInitialConnectWaitMs = 1000;
+// Where SpiceAPI listens, unless a Unix domain socket is given on the commandline
+const string kSpiceApiHost = "localhost";
+const uint16_t kSpiceApiPort = 1337;
+const string kSpiceApiPassword = "spicemaniax";
+
+// Our connection objects for communication with SpiceAPI, one per traffic class, so that lights polling
+// can never stall the stage inputs
+ConnectionSet connections(kSpiceApiHost, kSpiceApiPort, kSpiceApiPassword);
 // Util class for handling lights interactions (reading lights from SpiceAPI, outputting via SMX SDK)
 LightsUtils lights_util;
 // Util class for handling stage input ineractions (read stage inputs when the state changes, output via SpiceAPI)
 InputUtils input_utils;
-// Media Timer ID for the stage inputs timer
-static UINT stage_input_timer_id;
 // Media Timer ID for checking Spice API connectivity
 static UINT connection_check_timer_id;
 // Media Timer ID for redrawing the overlay
 static UINT thirty_hz_timer_id;
 // Media Timer ID for updating the window position
 static UINT window_position_timer_id;
+// Where to capture the SpiceAPI traffic to, if anywhere
+static string capture_path;
+// Local port to serve SpiceAPI to other tools on, 0 to not run the proxy
+static uint16_t proxy_port = 0;
 
 // Program entrypoint
 int WINAPI WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR, int cmd_show) {
@@ -92,10 +105,28 @@ int WINAPI WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR, int cmd_show) {
 
     printf("Loaded SMX.dll successfully, attempting to connect to SpiceAPI now\n");
 
+    // Start capturing the SpiceAPI traffic before the first request goes out
+    if (!capture_path.empty()) {
+        if (connections.StartCapture(capture_path)) {
+            printf("Capturing SpiceAPI traffic to %s\n", capture_path.c_str());
+        } else {
+            printf("Unable to open capture file %s\n", capture_path.c_str());
+        }
+    }
+
     // Connect to SpiceAPI, retry until it's successful
     WaitForConnection();
 
     printf("Connected to SpiceAPI successfully\n");
+
+    // Let other local tools share our connection, if asked to
+    if (proxy_port != 0) {
+        if (connections.StartProxy(proxy_port, kSpiceApiPassword)) {
+            printf("Serving SpiceAPI to other tools on port %u\n", proxy_port);
+        } else {
+            printf("Unable to start SpiceAPI proxy on port %u\n", proxy_port);
+        }
+    }
     printf("Creating overlay window in 10 seconds...\n");
 
     Sleep(10000);
@@ -117,8 +148,10 @@ int WINAPI WinMain(HINSTANCE h_instance, HINSTANCE, LPSTR, int cmd_show) {
     // Spice API is no longer connected, clean up and shut down
     printf("Lost connection to SpiceAPI, exiting\n");
 
-    // Clean up the timers we created
+    // Clean up the timers we created, and stop the SpiceAPI workers
     CleanupTimers();
+    connections.PrintStats();
+    input_utils.PrintStats();
     // Deregister the window for touch events
     UnregisterTouchWindow(hwnd);
     // Cleanup the touch overlay and release the Direct2D objects
@@ -188,6 +221,23 @@ void ParseArgs() {
     if (args_map.count(kOpacityArg) > 0) {
         overlay_opacity = stof(args_map[kOpacityArg]);
     }
+
+    if (args_map.count(kInputRefreshArg) > 0) {
+        input_refresh_interval_ms = stoi(args_map[kInputRefreshArg]);
+    }
+
+    // Connect over a Unix domain socket instead of TCP, if one was given
+    if (args_map.count(kApiSocketArg) > 0 && args_map[kApiSocketArg] != "") {
+        connections.ChangeHost("unix:" + args_map[kApiSocketArg], kSpiceApiPort);
+    }
+
+    if (args_map.count(kCaptureArg) > 0) {
+        capture_path = args_map[kCaptureArg];
+    }
+
+    if (args_map.count(kProxyArg) > 0) {
+        proxy_port = (uint16_t) stoi(args_map[kProxyArg]);
+    }
 }
 
 // Initialize all of our system timers for various IO tasks
@@ -195,9 +245,22 @@ void InitializeTimers() {
     // Set system media timer resolution to 1 ms, so we can have accurate timers for inputs and outputs
     timeBeginPeriod(1);
 
-    // Start a 1ms timer, so we can send stage inputs at 1000Hz
-    stage_input_timer_id = timeSetEvent(kInputsUpdateIntervalMs, 1, InputTimerCallback, 0, TIME_PERIODIC);
-    // Start a 33ms timer for triggering overlay redraws, sending pinpad inputs, and updating the lights
+    // Start the stage input worker. It always runs as soon as the inputs change, to send each pad transition
+    // right away. In change-driven mode it also runs on the refresh interval, otherwise it sends the full
+    // button state at 1000Hz.
+    UINT input_interval_ms = (input_refresh_interval_ms > 0) ? input_refresh_interval_ms : kInputsUpdateIntervalMs;
+    connections.GetWorker(TrafficClass::STAGE_INPUT).Start(input_interval_ms, [](Connection& con) {
+        input_utils.PerformMainInputTasks(con);
+    }, input_changed_event);
+    // Probe the stage input link from its own thread, so the input worker never blocks on a probe
+    connections.StartInputProbe();
+    // Start the async client for pinpad and card-in requests, which are queued from the 30Hz timer
+    connections.GetPinpadClient().start();
+    // Start the lights worker at 30Hz
+    connections.GetWorker(TrafficClass::LIGHTS).Start(k30HzTasksIntervalMs, [](Connection& con) {
+        lights_util.PerformLightsTasks(con);
+    });
+    // Start a 33ms timer for triggering overlay redraws
     thirty_hz_timer_id = timeSetEvent(k30HzTasksIntervalMs, 1, ThirtyHzTimerCallback, 0, TIME_PERIODIC);
     // Start a 3 second timer which polls for SpiceAPI connectivity
     connection_check_timer_id = timeSetEvent(kConnectionCheckIntervalMs, 1, ConnectivityCheckTimerCallback, 0, TIME_PERIODIC);
@@ -207,8 +270,8 @@ void InitializeTimers() {
 
 // Kills our timers and cleans up the timer resolution settings
 void CleanupTimers() {
-    // Kill the timers
-    timeKillEvent(stage_input_timer_id);
+    // Kill the timers and the workers
+    connections.StopAll();
     timeKillEvent(thirty_hz_timer_id);
     timeKillEvent(connection_check_timer_id);
     timeKillEvent(window_position_timer_id);
@@ -221,36 +284,55 @@ void SmxOnLog(const char* log) {
     printf("[SMX] %s\n", log);
 }
 
-// Checks for the SpiceAPI connection, and waits for it to be available if it's not
+// Connects to SpiceAPI, and waits for it to be available if it's not. The connections back off between
+// attempts, so this doesn't hog the CPU while the game is booting.
 void WaitForConnection() {
-    if (!con.check()) {
+    connections.StartConnecting();
+
+    if (!connections.WaitForAll(kInitialConnectWaitMs)) {
         printf("Unable to connect to SpiceAPI, waiting until connection is successful\n");
-        while (!con.check()) {
-            printf(".");
-        }
-        printf("\n");
+        connections.WaitForAll(INFINITE);
     }
+
+    Connection& input_con = connections.Get(TrafficClass::STAGE_INPUT);
+    printf("Connected after %llu attempts (%llums)\n",
+        (unsigned long long) input_con.get_connect_attempts(),
+        (unsigned long long) input_con.get_last_connect_time_ms());
 }
 
-// Callback for the 30Hz timer which updates the lights, sends pinpad updates, and redraws the overlay
+// Callback for the 30Hz timer which redraws the overlay and queues the pinpad and card-in requests.
+// Queueing never blocks, so a slow SpiceAPI can't hold up the timer thread. The lights updates run
+// on their own worker, at the same rate.
 void CALLBACK ThirtyHzTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR) {
-    lights_util.PerformLightsTasks(con);
-    input_utils.PerformPinpadInputTasks(con);
-    input_utils.PerformLoginInputTasks(con);
+    AsyncClient& pinpad_client = connections.GetPinpadClient();
+    input_utils.PerformPinpadInputTasks(pinpad_client);
+    input_utils.PerformLoginInputTasks(pinpad_client);
     InvalidateRect(hwnd, NULL, FALSE);
 }
 
-// Callback for the 1ms timer we set for the stage inputs, to always output at 1000Hz
-void CALLBACK InputTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR) {
-    input_utils.PerformMainInputTasks(con);
-}
-
-// Callback for the timer which triggers a SpiceAPI connectivity check
+// Callback for the timer which triggers a SpiceAPI connectivity check. Each worker checks its own
+// connection, so we only need to look at the results here.
 void CALLBACK ConnectivityCheckTimerCallback(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR) {
-    if (!con.check()) {
+    static uint64_t last_input_deadline_misses = 0;
+
+    if (connections.IsAnyConnectionLost()) {
         // If we lose the connection to SpiceAPI, exit the program
         PostQuitMessage(0);
     }
+
+    // Report whenever the stage input worker has fallen behind since the last check
+    ConnectionWorker& input_worker = connections.GetWorker(TrafficClass::STAGE_INPUT);
+    uint64_t input_deadline_misses = input_worker.GetDeadlineMisses();
+
+    if (input_deadline_misses != last_input_deadline_misses) {
+        printf("[%s] missed %llu deadlines in the last %dms (%llu total, worst task time %lluus)\n",
+            input_worker.GetName(),
+            (unsigned long long) (input_deadline_misses - last_input_deadline_misses),
+            kConnectionCheckIntervalMs,
+            (unsigned long long) input_deadline_misses,
+            (unsigned long long) input_worker.GetWorstTaskTimeUs());
+        last_input_deadline_misses = input_deadline_misses;
+    }
 }
 
 // Callback for the timer which triggers the window to reposition itself on top of everything else
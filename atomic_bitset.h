@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#include <intrin.h>
+#endif
+
+/*
+    Set of up to 64 flags packed into a single atomic word. Any thread can set or clear bits without locking,
+    and readers get every flag at once with one load, which is also a consistent view of all of them. Comparing
+    a load against an earlier one with XOR gives the flags which changed since then.
+*/
+template<size_t Bits>
+class AtomicBitset {
+    static_assert(Bits > 0 && Bits <= 64, "AtomicBitset holds at most 64 bits");
+
+public:
+    void Set(size_t index, bool value) {
+        uint64_t mask = uint64_t(1) << index;
+
+        if (value) {
+            bits_.fetch_or(mask, std::memory_order_release);
+        } else {
+            bits_.fetch_and(~mask, std::memory_order_release);
+        }
+    }
+
+    // Returns every flag at once
+    uint64_t Load() const {
+        return bits_.load(std::memory_order_acquire);
+    }
+
+    // Returns the flags which changed since `previous`, and updates `previous` to the current state
+    uint64_t Changes(uint64_t& previous) const {
+        uint64_t current = Load();
+        uint64_t changed = current ^ previous;
+        previous = current;
+        return changed;
+    }
+
+    static bool Test(uint64_t bits, size_t index) {
+        return ((bits >> index) & 1) != 0;
+    }
+
+    // Removes the lowest set bit from `bits` and returns its index. `bits` must not be 0.
+    static size_t PopLowest(uint64_t& bits) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+#elif defined(__GNUC__)
+        size_t index = __builtin_ctzll(bits);
+#else
+        size_t index = 0;
+        while (((bits >> index) & 1) == 0) {
+            index++;
+        }
+#endif
+        bits &= bits - 1;
+        return index;
+    }
+
+private:
+    std::atomic<uint64_t> bits_{ 0 };
+};
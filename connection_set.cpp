@@ -0,0 +1,492 @@
+#include "connection_set.h"
+
+#include <mmsystem.h>
+#include <chrono>
+
+using namespace std::chrono;
+
+ConnectionWorker::ConnectionWorker(const char* name, Connection& con, int thread_priority) :
+    name_(name), con_(con), thread_priority_(thread_priority) {
+}
+
+ConnectionWorker::~ConnectionWorker() {
+    Stop();
+}
+
+// Starts the worker thread, and the multimedia timer which wakes it up every `interval_ms`. If a wake
+// event is given, signaling it also runs the task without waiting for the next tick.
+bool ConnectionWorker::Start(UINT interval_ms, function<void(Connection&)> task, HANDLE wake_event) {
+    interval_ms_ = interval_ms;
+    task_ = task;
+    wake_event_ = wake_event;
+    tick_event_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+    stop_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (tick_event_ == NULL || stop_event_ == NULL) {
+        printf("[%s] Unable to create worker events\n", name_);
+        return false;
+    }
+
+    thread_ = thread(&ConnectionWorker::Run, this);
+    SetThreadPriority(thread_.native_handle(), thread_priority_);
+
+    // Have the timer signal our event directly, rather than running a callback on the shared timer thread
+    timer_id_ = timeSetEvent(interval_ms_, 1, (LPTIMECALLBACK) tick_event_, 0,
+        TIME_PERIODIC | TIME_CALLBACK_EVENT_SET);
+
+    if (timer_id_ == 0) {
+        printf("[%s] Unable to start worker timer\n", name_);
+        return false;
+    }
+
+    return true;
+}
+
+// Stops the timer and waits for the worker thread to finish its current task
+void ConnectionWorker::Stop() {
+    if (timer_id_ != 0) {
+        timeKillEvent(timer_id_);
+        timer_id_ = 0;
+    }
+
+    if (thread_.joinable()) {
+        SetEvent(stop_event_);
+        thread_.join();
+    }
+
+    if (tick_event_ != NULL) {
+        CloseHandle(tick_event_);
+        tick_event_ = NULL;
+    }
+
+    if (stop_event_ != NULL) {
+        CloseHandle(stop_event_);
+        stop_event_ = NULL;
+    }
+}
+
+// Main loop for the worker thread, which runs the task every time the timer ticks or it gets woken up
+void ConnectionWorker::Run() {
+    HANDLE events[3] = { stop_event_, tick_event_, wake_event_ };
+    DWORD event_count = (wake_event_ != NULL) ? 3 : 2;
+    auto last_probe = steady_clock::now();
+    uint64_t timer_ticks = 0;
+
+    while (true) {
+        DWORD result = WaitForMultipleObjects(event_count, events, FALSE, INFINITE);
+
+        if (result != WAIT_OBJECT_0 + 1 && result != WAIT_OBJECT_0 + 2) {
+            break;
+        }
+
+        // Back off timer ticks while the link is unhealthy, wake-ups still run right away since they carry
+        // a fresh state change
+        const LinkHealth& health = (health_source_ != nullptr) ? *health_source_ : con_.get_metrics().health;
+        LinkState link_state = health.get_state();
+        bool skip = false;
+
+        if (result == WAIT_OBJECT_0 + 1) {
+            timer_ticks++;
+            skip = (link_state == LINK_DEAD) ||
+                (link_state == LINK_DEGRADED && timer_ticks % kDegradedTickDivisor != 0);
+        }
+
+        if (skip) {
+            skipped_ticks_++;
+        } else {
+            RunTask();
+        }
+
+        // Periodically probe the connection from this thread, since we own it, unless it's probed elsewhere.
+        // A dead link gets dropped by the probe, so the check after it reconnects.
+        auto now = steady_clock::now();
+
+        if (duration_cast<milliseconds>(now - last_probe).count() >= kWorkerProbeIntervalMs) {
+            last_probe = now;
+
+            if (health_source_ == nullptr) {
+                health_probe(con_);
+            }
+
+            CheckConnection(now);
+        }
+    }
+}
+
+// Makes sure the connection is up, reconnecting if needed. It only counts as lost once reconnecting has kept
+// failing for the grace period, so a hiccup which got the link dropped doesn't take the whole program down.
+void ConnectionWorker::CheckConnection(steady_clock::time_point now) {
+    if (con_.check()) {
+        down_since_ = steady_clock::time_point();
+        connection_lost_ = false;
+    } else if (down_since_ == steady_clock::time_point()) {
+        down_since_ = now;
+    } else if (duration_cast<milliseconds>(now - down_since_).count() >= kWorkerConnectionLostGraceMs) {
+        connection_lost_ = true;
+    }
+}
+
+// Runs the task once and records how long it took
+void ConnectionWorker::RunTask() {
+    auto start = steady_clock::now();
+    task_(con_);
+    auto end = steady_clock::now();
+
+    // Prepare for the next tick while we're waiting for it anyway
+    con_.idle();
+
+    // If the task ran longer than the interval, the next tick was either late or coalesced into this one
+    uint64_t task_time_us = duration_cast<microseconds>(end - start).count();
+    ticks_++;
+
+    if (task_time_us > interval_ms_ * 1000ull) {
+        deadline_misses_++;
+    }
+
+    if (task_time_us > worst_task_time_us_) {
+        worst_task_time_us_ = task_time_us;
+    }
+}
+
+ConnectionSet::ConnectionSet(const string& host, uint16_t port, const string& password) :
+    stage_input_con_(host, port, password),
+    pinpad_con_(host, port, password),
+    lights_con_(host, port, password),
+    proxy_con_(host, port, password),
+    input_probe_con_(host, port, password),
+    stage_input_worker_("input", stage_input_con_, THREAD_PRIORITY_TIME_CRITICAL),
+    pinpad_client_("pinpad", pinpad_con_),
+    lights_worker_("lights", lights_con_, THREAD_PRIORITY_BELOW_NORMAL) {
+    stage_input_con_.set_timeout(kStageInputRequestTimeoutMs);
+    pinpad_con_.set_timeout(kPinpadRequestTimeoutMs);
+    lights_con_.set_timeout(kLightsRequestTimeoutMs);
+
+    stage_input_worker_.SetHealthSource(input_probe_con_.get_metrics().health);
+    connected_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+    input_probe_stop_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+ConnectionSet::~ConnectionSet() {
+    connect_stop_ = true;
+
+    if (connect_thread_.joinable()) {
+        connect_thread_.join();
+    }
+
+    if (connected_event_ != NULL) {
+        CloseHandle(connected_event_);
+    }
+
+    if (input_probe_thread_.joinable()) {
+        SetEvent(input_probe_stop_event_);
+        input_probe_thread_.join();
+    }
+
+    if (input_probe_stop_event_ != NULL) {
+        CloseHandle(input_probe_stop_event_);
+    }
+}
+
+// Returns the connection for the given traffic class
+Connection& ConnectionSet::Get(TrafficClass traffic_class) {
+    switch (traffic_class) {
+    case TrafficClass::STAGE_INPUT:
+        return stage_input_con_;
+    case TrafficClass::PINPAD:
+        return pinpad_con_;
+    case TrafficClass::LIGHTS:
+    default:
+        return lights_con_;
+    }
+}
+
+// Returns the worker for the given traffic class. Pinpad traffic goes through an async client instead,
+// see GetPinpadClient().
+ConnectionWorker& ConnectionSet::GetWorker(TrafficClass traffic_class) {
+    switch (traffic_class) {
+    case TrafficClass::STAGE_INPUT:
+        return stage_input_worker_;
+    case TrafficClass::LIGHTS:
+    default:
+        return lights_worker_;
+    }
+}
+
+// Points every connection at a different SpiceAPI host. Like CheckAll, this must only be called while
+// the workers are stopped.
+void ConnectionSet::ChangeHost(const string& host, uint16_t port) {
+    stage_input_con_.change_host(host, port);
+    pinpad_con_.change_host(host, port);
+    lights_con_.change_host(host, port);
+    proxy_con_.change_host(host, port);
+    input_probe_con_.change_host(host, port);
+}
+
+// Records the decrypted traffic of every connection into a capture file, tagged with its traffic class.
+// Like ChangeHost, this must only be called while the workers are stopped.
+bool ConnectionSet::StartCapture(const string& path) {
+    capture_ = make_unique<CaptureWriter>(path);
+
+    if (!capture_->is_open()) {
+        capture_.reset();
+        return false;
+    }
+
+    stage_input_con_.set_capture(capture_.get(), (uint8_t) TrafficClass::STAGE_INPUT);
+    pinpad_con_.set_capture(capture_.get(), (uint8_t) TrafficClass::PINPAD);
+    lights_con_.set_capture(capture_.get(), (uint8_t) TrafficClass::LIGHTS);
+    proxy_con_.set_capture(capture_.get(), kProxyCaptureChannel);
+    return true;
+}
+
+// Starts serving SpiceAPI on the given local port for other tools, multiplexed over our own proxy connection.
+// Clients use the given password, like they would for SpiceAPI itself. The proxy connects upstream on its own
+// when the first request comes in, so it doesn't hold up startup.
+bool ConnectionSet::StartProxy(uint16_t port, const string& password) {
+    proxy_ = make_unique<Proxy>(proxy_con_, password);
+
+    if (!proxy_->start(port)) {
+        proxy_.reset();
+        return false;
+    }
+
+    return true;
+}
+
+// Starts probing the stage input link. The input worker runs at up to 1000Hz on a time critical thread, so a
+// blocking probe between its ticks would stall the inputs, and a timed out probe would leave its response in
+// front of the next input request. So the probes go over a separate connection from their own thread, and
+// the input worker only backs off based on what they find.
+void ConnectionSet::StartInputProbe() {
+    if (input_probe_thread_.joinable())
+        return;
+
+    ResetEvent(input_probe_stop_event_);
+    input_probe_thread_ = thread(&ConnectionSet::InputProbeLoop, this);
+    SetThreadPriority(input_probe_thread_.native_handle(), THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+void ConnectionSet::InputProbeLoop() {
+    HealthProbeConfig config;
+    config.timeout_ms = kStageInputProbeTimeoutMs;
+    config.degraded_rtt_us = kStageInputDegradedRttUs;
+
+    while (WaitForSingleObject(input_probe_stop_event_, kWorkerProbeIntervalMs) == WAIT_TIMEOUT) {
+        health_probe(input_probe_con_, config);
+    }
+}
+
+// Checks (and if needed, establishes) every connection. This must only be called while the workers
+// are stopped, since each worker owns its connection while it's running.
+bool ConnectionSet::CheckAll() {
+    bool stage_input_ok = stage_input_con_.check();
+    bool pinpad_ok = pinpad_con_.check();
+    bool lights_ok = lights_con_.check();
+    return stage_input_ok && pinpad_ok && lights_ok;
+}
+
+// Starts establishing every connection in the background. Each connection backs off between attempts on
+// its own, so this thread just sleeps until the next one is due rather than spinning. The connected event
+// is signaled once all of them are up.
+void ConnectionSet::StartConnecting() {
+    if (connect_thread_.joinable())
+        return;
+
+    ResetEvent(connected_event_);
+    connect_stop_ = false;
+    connect_thread_ = thread(&ConnectionSet::ConnectLoop, this);
+    SetThreadPriority(connect_thread_.native_handle(), THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+// Waits for the connect thread to establish every connection, returns false on timeout
+bool ConnectionSet::WaitForAll(DWORD timeout_ms) {
+    if (WaitForSingleObject(connected_event_, timeout_ms) != WAIT_OBJECT_0)
+        return false;
+
+    // The thread exits right after signaling, and must be gone before the workers take over
+    if (connect_thread_.joinable())
+        connect_thread_.join();
+
+    return true;
+}
+
+void ConnectionSet::ConnectLoop() {
+    Connection* cons[kTrafficClassCount] = { &stage_input_con_, &pinpad_con_, &lights_con_ };
+
+    while (!connect_stop_) {
+        if (CheckAll()) {
+            SetEvent(connected_event_);
+            return;
+        }
+
+        // Sleep until the soonest connection is allowed to try again
+        int wait_ms = kWorkerConnectionCheckIntervalMs;
+
+        for (Connection* con : cons) {
+            int con_wait_ms = con->reconnect_wait_ms();
+
+            if (con_wait_ms > 0 && con_wait_ms < wait_ms) {
+                wait_ms = con_wait_ms;
+            }
+        }
+
+        Sleep(wait_ms);
+    }
+}
+
+// Says whether any of the workers have lost their connection to SpiceAPI
+bool ConnectionSet::IsAnyConnectionLost() {
+    return stage_input_worker_.IsConnectionLost() ||
+        pinpad_client_.is_connection_lost() ||
+        lights_worker_.IsConnectionLost();
+}
+
+// Stops all the workers and the async client
+void ConnectionSet::StopAll() {
+    stage_input_worker_.Stop();
+    pinpad_client_.stop();
+    lights_worker_.Stop();
+
+    if (input_probe_thread_.joinable()) {
+        SetEvent(input_probe_stop_event_);
+        input_probe_thread_.join();
+    }
+
+    if (proxy_) {
+        proxy_->stop();
+    }
+}
+
+// Prints the tick and deadline counters for each worker, and the queue counters for the async client
+void ConnectionSet::PrintStats() {
+    ConnectionWorker* workers[2] = { &stage_input_worker_, &lights_worker_ };
+
+    for (ConnectionWorker* worker : workers) {
+        printf("[%s] ticks: %llu, missed deadlines: %llu, worst task time: %lluus, skipped ticks: %llu\n",
+            worker->GetName(),
+            (unsigned long long) worker->GetTicks(),
+            (unsigned long long) worker->GetDeadlineMisses(),
+            (unsigned long long) worker->GetWorstTaskTimeUs(),
+            (unsigned long long) worker->GetSkippedTicks());
+    }
+
+    printf("[%s] submitted: %llu, completed: %llu, failed: %llu, dropped: %llu, batches: %llu, max queue depth: %zu\n",
+        pinpad_client_.get_name().c_str(),
+        (unsigned long long) pinpad_client_.get_submitted(),
+        (unsigned long long) pinpad_client_.get_completed(),
+        (unsigned long long) pinpad_client_.get_failed(),
+        (unsigned long long) pinpad_client_.get_dropped(),
+        (unsigned long long) pinpad_client_.get_batches(),
+        pinpad_client_.get_queue_high_water());
+
+    // Queue and wait time for each priority class the async client has seen
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        const AsyncClient::ClassStats& stats = pinpad_client_.get_class_stats((Priority) priority);
+        uint64_t dispatched = stats.dispatched;
+
+        if (stats.submitted == 0) {
+            continue;
+        }
+
+        printf("[%s/%s] submitted: %llu, dropped: %llu, queue depth: %zu (max %zu), wait: %lluus avg, %lluus max\n",
+            pinpad_client_.get_name().c_str(),
+            priority_name((Priority) priority),
+            (unsigned long long) stats.submitted,
+            (unsigned long long) stats.dropped,
+            (size_t) stats.queue_depth,
+            (size_t) stats.queue_high_water,
+            (unsigned long long) (dispatched > 0 ? stats.wait_total_us / dispatched : 0),
+            (unsigned long long) stats.wait_max_us);
+    }
+
+    // Reconnect and timeout counters for each connection
+    const char* names[kTrafficClassCount] = { "input", "pinpad", "lights" };
+    Connection* cons[kTrafficClassCount] = { &stage_input_con_, &pinpad_con_, &lights_con_ };
+
+    for (size_t i = 0; i < kTrafficClassCount; i++) {
+        printf("[%s] connect attempts: %llu, connects: %llu, last time to connect: %llums, timeouts: %llu, late responses discarded: %llu\n",
+            names[i],
+            (unsigned long long) cons[i]->get_connect_attempts(),
+            (unsigned long long) cons[i]->get_connects(),
+            (unsigned long long) cons[i]->get_last_connect_time_ms(),
+            (unsigned long long) cons[i]->get_timeouts(),
+            (unsigned long long) cons[i]->get_stale_discarded());
+    }
+
+    if (proxy_) {
+        printf("[proxy] clients: %llu, requests: %llu, forwarded: %llu, cache hits: %llu, coalesced: %llu, errors: %llu\n",
+            (unsigned long long) proxy_->get_accepted(),
+            (unsigned long long) proxy_->get_requests(),
+            (unsigned long long) proxy_->get_forwarded(),
+            (unsigned long long) proxy_->get_cache_hits(),
+            (unsigned long long) proxy_->get_coalesced(),
+            (unsigned long long) proxy_->get_errors());
+    }
+
+    if (capture_) {
+        printf("[capture] records: %llu, dropped: %llu\n", (unsigned long long) capture_->get_records(),
+            (unsigned long long) capture_->get_dropped());
+    }
+
+    PrintMetrics();
+}
+
+// Prints the latency percentiles and byte counters for every endpoint each connection has used. The
+// metrics are recorded lock-free, so this can be called at any time while the workers are running.
+void ConnectionSet::PrintMetrics() {
+    const char* names[kTrafficClassCount] = { "input", "pinpad", "lights" };
+    Connection* cons[kTrafficClassCount] = { &stage_input_con_, &pinpad_con_, &lights_con_ };
+
+    for (size_t i = 0; i < kTrafficClassCount; i++) {
+        const ConnectionMetrics& metrics = cons[i]->get_metrics();
+
+        for (int endpoint = 0; endpoint < ENDPOINT_COUNT; endpoint++) {
+            const EndpointMetrics& stats = metrics[(Endpoint) endpoint];
+
+            if (stats.requests == 0) {
+                continue;
+            }
+
+            printf("[%s/%s] requests: %llu, errors: %llu, bytes out: %llu, bytes in: %llu\n",
+                names[i],
+                endpoint_name((Endpoint) endpoint),
+                (unsigned long long) stats.requests,
+                (unsigned long long) stats.errors,
+                (unsigned long long) stats.bytes_out,
+                (unsigned long long) stats.bytes_in);
+            PrintHistogram(names[i], "round trip", stats.round_trip);
+            PrintHistogram(names[i], "serialize", stats.serialize);
+            PrintHistogram(names[i], "parse", stats.parse);
+        }
+
+        // The stage input link is probed over its own connection
+        const LinkHealth& health = (cons[i] == &stage_input_con_) ? input_probe_con_.get_metrics().health : metrics.health;
+
+        if (health.probes > 0) {
+            printf("[%s] link: %s, probes: %llu, failed: %llu, degraded: %llu, died: %llu, last rtt: %.1fus\n",
+                names[i],
+                link_state_name(health.get_state()),
+                (unsigned long long) health.probes,
+                (unsigned long long) health.failures,
+                (unsigned long long) health.degraded,
+                (unsigned long long) health.dead,
+                health.last_rtt_ns / 1000.0);
+            PrintHistogram(names[i], "probe rtt", health.rtt);
+        }
+
+        if (metrics.crypt.count() > 0) {
+            printf("[%s] crypted bytes: %llu\n", names[i], (unsigned long long) metrics.crypt_bytes);
+            PrintHistogram(names[i], "crypt", metrics.crypt);
+        }
+    }
+}
+
+void ConnectionSet::PrintHistogram(const char* name, const char* label, const LatencyHistogram& histogram) {
+    printf("[%s]   %-10s p50: %.1fus, p99: %.1fus, p99.9: %.1fus, max: %.1fus\n",
+        name,
+        label,
+        histogram.percentile(50) / 1000.0,
+        histogram.percentile(99) / 1000.0,
+        histogram.percentile(99.9) / 1000.0,
+        histogram.max_value() / 1000.0);
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "spiceapi/async_client.h"
+#include "spiceapi/capture.h"
+#include "spiceapi/connection.h"
+#include "spiceapi/proxy.h"
+
+#include <windows.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace spiceapi;
+using namespace std;
+
+// The classes of SpiceAPI traffic we generate. Each class gets its own socket, cipher and thread, so a
+// slow request in one class (e.g. a large tape LED read) can never hold up the others. The stage input
+// and lights classes are polled by a worker, while pinpad requests are queued on an async client.
+enum class TrafficClass {
+    STAGE_INPUT = 0,
+    PINPAD = 1,
+    LIGHTS = 2
+};
+
+static constexpr size_t kTrafficClassCount = 3;
+
+// The proxy's upstream connection isn't a traffic class of our own, its capture records get the next channel
+static constexpr uint8_t kProxyCaptureChannel = kTrafficClassCount;
+
+// How often each worker re-validates its own SpiceAPI connection between ticks
+static constexpr uint32_t kWorkerConnectionCheckIntervalMs = 3000;
+// How long a worker's connection can keep failing to reconnect before it counts as lost
+static constexpr uint32_t kWorkerConnectionLostGraceMs = 5000;
+
+// How often each worker probes its connection's round trip time, and checks that it's still connected.
+// While a link is degraded, timer ticks only run the task every kDegradedTickDivisor ticks so we don't keep
+// piling requests onto it, and while it's dead they're skipped entirely until it reconnects or a probe gets
+// through again.
+static constexpr uint32_t kWorkerProbeIntervalMs = 1000;
+static constexpr uint64_t kDegradedTickDivisor = 4;
+
+// The input worker can't afford to block on a probe at all, so its link is probed from a separate thread
+// and connection. Anything over a millisecond is already noticeable on the stage.
+static constexpr int kStageInputProbeTimeoutMs = 20;
+static constexpr uint64_t kStageInputDegradedRttUs = 1000;
+
+// How long each traffic class waits for a response before abandoning the request. Input is only useful
+// within about a tick, and a lights poll that misses its frame is superseded by the next one anyway.
+static constexpr int kStageInputRequestTimeoutMs = 2;
+static constexpr int kPinpadRequestTimeoutMs = 100;
+static constexpr int kLightsRequestTimeoutMs = 33;
+
+/*
+    A worker thread which owns a single SpiceAPI connection, and runs a task against it on a fixed
+    interval. The interval is driven by a multimedia timer which signals an event, rather than running
+    the task inside the timer callback itself, since all multimedia timer callbacks share one thread.
+    The worker is the only thread which ever touches its connection.
+*/
+class ConnectionWorker {
+public:
+    ConnectionWorker(const char* name, Connection& con, int thread_priority);
+    ~ConnectionWorker();
+    bool Start(UINT interval_ms, function<void(Connection&)> task, HANDLE wake_event = NULL);
+    void Stop();
+    void SetHealthSource(const LinkHealth& health) { health_source_ = &health; }
+
+    const char* GetName() const { return name_; }
+    UINT GetIntervalMs() const { return interval_ms_; }
+    bool IsConnectionLost() const { return connection_lost_; }
+    uint64_t GetTicks() const { return ticks_; }
+    uint64_t GetDeadlineMisses() const { return deadline_misses_; }
+    uint64_t GetWorstTaskTimeUs() const { return worst_task_time_us_; }
+    uint64_t GetSkippedTicks() const { return skipped_ticks_; }
+
+private:
+    void Run();
+    void RunTask();
+    void CheckConnection(chrono::steady_clock::time_point now);
+
+    const char* name_;
+    Connection& con_;
+    int thread_priority_;
+    UINT interval_ms_ = 0;
+    function<void(Connection&)> task_;
+    // If set, the link is probed elsewhere and the worker only backs off based on it, instead of probing its
+    // own connection between ticks
+    const LinkHealth* health_source_ = nullptr;
+    // When the connection started failing to reconnect, if it currently is
+    chrono::steady_clock::time_point down_since_;
+
+    // Auto-reset event the multimedia timer signals every interval, and a manual-reset event for shutdown
+    HANDLE tick_event_ = NULL;
+    HANDLE stop_event_ = NULL;
+    // Optional auto-reset event owned by the caller, which runs the task right away when signaled
+    HANDLE wake_event_ = NULL;
+    UINT timer_id_ = 0;
+    thread thread_;
+
+    // Set while the worker has been failing to re-establish its connection to SpiceAPI for longer than the grace period
+    atomic<bool> connection_lost_{ false };
+    // Number of times the task has run
+    atomic<uint64_t> ticks_{ 0 };
+    // Number of times the task took longer than the interval, meaning the next tick was late or dropped
+    atomic<uint64_t> deadline_misses_{ 0 };
+    // The longest single run of the task, in microseconds
+    atomic<uint64_t> worst_task_time_us_{ 0 };
+    // Number of timer ticks skipped because the link was degraded or dead
+    atomic<uint64_t> skipped_ticks_{ 0 };
+};
+
+/*
+    The full set of SpiceAPI connections the program uses, one per traffic class, plus the worker
+    or async client which drives each of them.
+*/
+class ConnectionSet {
+public:
+    ConnectionSet(const string& host, uint16_t port, const string& password);
+    ~ConnectionSet();
+    Connection& Get(TrafficClass traffic_class);
+    ConnectionWorker& GetWorker(TrafficClass traffic_class);
+    AsyncClient& GetPinpadClient() { return pinpad_client_; }
+    void ChangeHost(const string& host, uint16_t port);
+    bool StartCapture(const string& path);
+    bool StartProxy(uint16_t port, const string& password);
+    void StartInputProbe();
+    bool CheckAll();
+    void StartConnecting();
+    bool WaitForAll(DWORD timeout_ms);
+    HANDLE GetConnectedEvent() const { return connected_event_; }
+    bool IsAnyConnectionLost();
+    void StopAll();
+    void PrintStats();
+    void PrintMetrics();
+
+private:
+    // Optional capture of all traffic, declared first so it outlives the connections writing to it
+    unique_ptr<CaptureWriter> capture_;
+
+    Connection stage_input_con_;
+    Connection pinpad_con_;
+    Connection lights_con_;
+    // Upstream connection for the optional proxy, shared by every tool connected to it
+    Connection proxy_con_;
+    // Connection which only probes the stage input link, so probing never blocks the input worker
+    Connection input_probe_con_;
+    ConnectionWorker stage_input_worker_;
+    AsyncClient pinpad_client_;
+    ConnectionWorker lights_worker_;
+    unique_ptr<Proxy> proxy_;
+
+    static void PrintHistogram(const char* name, const char* label, const LatencyHistogram& histogram);
+
+    // Thread which establishes all the connections at startup, and the manual-reset event it signals
+    // once they're all up
+    void ConnectLoop();
+    thread connect_thread_;
+    HANDLE connected_event_ = NULL;
+    atomic<bool> connect_stop_{ false };
+
+    // Thread which probes the stage input link, and the manual-reset event which stops it
+    void InputProbeLoop();
+    thread input_probe_thread_;
+    HANDLE input_probe_stop_event_ = NULL;
+};
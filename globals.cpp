@@ -6,11 +6,17 @@ HWND hwnd;
 std::vector<RECT> overlay_buttons;
 // Storage for the new set of buttons, which include a lot more metadata for rendering
 std::vector<OverlayButton> touch_overlay_buttons;
-// Mapping of button IDs to button press states
-std::map<int, bool> touch_overlay_button_states;
+// The latest pad state, readable from any thread without locking
+SnapshotStore<InputSnapshot> input_snapshot;
+// Press state of each overlay button, one bit per button
+AtomicBitset<kMaxOverlayButtons> overlay_button_states;
 // Says whether the overlay is currently being shown or not for each player
 bool is_overlay_visible[2] = { false, false };
 // The card IDs to use for each player, if available
 std::string card_ids[2] = { "", "" };
 // The opacity value to use for the overlay, between 0.0 and 1.0
 float overlay_opacity = 0.6f;
+// How often the full button state is re-sent to SpiceAPI, in milliseconds (0 = every input tick)
+int input_refresh_interval_ms = 100;
+// Auto-reset event which is signaled whenever the stage or overlay input state changes
+HANDLE input_changed_event = CreateEvent(NULL, FALSE, FALSE, NULL);
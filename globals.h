@@ -2,8 +2,12 @@
 
 #define WIN32_LEAN_AND_MEAN
 
+#include "atomic_bitset.h"
+#include "input_frame.h"
 #include "overlay_button.h"
+#include "snapshot_store.h"
 #include <windows.h>
+#include <cstdint>
 #include <map>
 #include <vector>
 
@@ -11,11 +15,20 @@
 extern HWND hwnd;
 // Storage for the new set of buttons, which include a lot more metadata for rendering
 extern std::vector<OverlayButton> touch_overlay_buttons;
-// Mapping of button IDs to button press states
-extern std::map<int, bool> touch_overlay_button_states;
+
+// The latest pad state, readable from any thread without locking
+extern SnapshotStore<InputSnapshot> input_snapshot;
+// Press state of each overlay button, one bit per button at its `state_index_`. The UI thread sets the bits,
+// and everyone else reads all of them with a single load.
+extern AtomicBitset<kMaxOverlayButtons> overlay_button_states;
 // Says whether the overlay is currently being shown or not for each player
 extern bool is_overlay_visible[2];
 // The card IDs to use for each player, if available
 extern std::string card_ids[2];
 // The opacity value to use for the overlay, between 0.0 and 1.0
 extern float overlay_opacity;
+// How often the full button state is re-sent to SpiceAPI, in milliseconds. In between, buttons are
+// only sent when they change. If this is 0, the full button state is sent on every input tick instead.
+extern int input_refresh_interval_ms;
+// Auto-reset event which is signaled whenever the stage or overlay input state changes
+extern HANDLE input_changed_event;
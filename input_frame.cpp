@@ -0,0 +1,145 @@
+#include "input_frame.h"
+
+// Works out the arrow values for every panel state up front, so turning a pad state into the values to send
+// is a single table lookup
+constexpr array<array<bool, 4>, kPanelStateCount> InputFrame::BuildPanelArrows() {
+    array<array<bool, 4>, kPanelStateCount> arrows{};
+
+    for (size_t state = 0; state < kPanelStateCount; state++) {
+        for (size_t panel = 0; panel < 4; panel++) {
+            arrows[state][panel] = BIT(state, kPanelIndices[panel]) != 0;
+        }
+    }
+
+    return arrows;
+}
+
+const array<array<bool, 4>, kPanelStateCount> InputFrame::kPanelArrows = InputFrame::BuildPanelArrows();
+
+InputFrame::InputFrame(SnapshotStore<InputSnapshot>& snapshot, const AtomicBitset<kMaxOverlayButtons>& overlay_states,
+    const vector<OverlayButton>& overlay_buttons, bool (&overlay_visible)[2])
+    : snapshot_(snapshot), overlay_states_(overlay_states), overlay_buttons_(overlay_buttons),
+      overlay_visible_(overlay_visible) {
+}
+
+// Publishes a new state for one pad and queues the transition for the next tick. This runs on the SMX SDK's
+// thread, which is the only producer for the transition queue, so it must never block.
+void InputFrame::OnPadState(int pad, uint16_t state) {
+    snapshot_.Update([pad, state](InputSnapshot& snapshot) {
+        snapshot.pad_states[pad] = state;
+    });
+
+    // Queue the transition itself, so a press and release that both land before the worker wakes up
+    // still reach the game as two edges
+    if (!pad_transitions_.TryPush({ pad, state, metrics_now() })) {
+        pad_transitions_dropped_++;
+        pad_transitions_overflowed_ = true;
+    }
+}
+
+// Patches the stage input values for one pad into the request. The request is prebuilt, so we only need
+// to patch in the values.
+void InputFrame::ApplyPadState(size_t player, uint16_t state) {
+    const array<bool, 4>& arrows = kPanelArrows[state & (kPanelStateCount - 1)];
+
+    for (size_t panel = 0; panel < 4; panel++) {
+        buttons_request_.set(kStageInputIds[player][panel], arrows[panel]);
+    }
+}
+
+// Sends the buttons that changed since the last request, or everything in 1000Hz mode
+bool InputFrame::SendChanges(Connection& con, int refresh_interval_ms) {
+    if (refresh_interval_ms <= 0) {
+        return buttons_write(con, buttons_request_);
+    }
+
+    // If this fails, refresh the full state on the next run
+    if (!buttons_write_changes(con, buttons_request_)) {
+        last_refresh_ = steady_clock::time_point();
+        return false;
+    }
+
+    return true;
+}
+
+// Sends the stage inputs and menu button inputs to SpiceAPI. This runs on the input worker, which is the only
+// consumer of the transition queue. It runs at up to 1000Hz, so once warmed up it must not touch the heap:
+// tools/input_alloc_check runs it with every allocation counted.
+void InputFrame::Tick(Connection& con, int refresh_interval_ms) {
+    ApplyOverlayInputs();
+
+    // Send every pad transition on its own and in order, as soon as it arrives. Panels we don't map (the
+    // corners and center) change the pad state without changing the request, so those don't send anything.
+    PadTransition transition;
+    bool sent_transition = false;
+
+    while (pad_transitions_.TryPop(transition)) {
+        ApplyPadState(transition.pad, transition.state);
+
+        if (buttons_request_.changed()) {
+            SendChanges(con, refresh_interval_ms);
+            transition_latency_.record(metrics_now() - transition.time_ns);
+            sent_transition = true;
+        }
+    }
+
+    // If transitions were dropped, at least make sure the game ends up with the latest state
+    if (pad_transitions_overflowed_.exchange(false)) {
+        InputSnapshot latest = snapshot_.Read();
+
+        for (size_t player = 0; player < 2; player++) {
+            ApplyPadState(player, latest.pad_states[player]);
+        }
+    }
+
+    // Send the regular button updates + stage updates. In change-driven mode, only the buttons that
+    // changed are sent, plus the full state every refresh interval in case SpiceAPI lost track of it.
+    if (refresh_interval_ms <= 0) {
+        if (!sent_transition || buttons_request_.changed()) {
+            buttons_write(con, buttons_request_);
+        }
+
+        return;
+    }
+
+    auto now = steady_clock::now();
+
+    if (duration_cast<milliseconds>(now - last_refresh_).count() + kInputRefreshToleranceMs >= refresh_interval_ms) {
+        if (buttons_write(con, buttons_request_)) {
+            last_refresh_ = now;
+        }
+    } else if (buttons_request_.changed()) {
+        SendChanges(con, refresh_interval_ms);
+    }
+}
+
+// Patches the touch overlay input values that changed since the last run into the request, and handles the
+// visibility toggles. The request keeps the values it was given, so only the changes need to be applied.
+void InputFrame::ApplyOverlayInputs() {
+    uint64_t changed = overlay_states_.Changes(last_overlay_states_);
+
+    while (changed != 0) {
+        size_t index = overlay_states_.PopLowest(changed);
+        const OverlayButton& button = overlay_buttons_[index];
+        bool is_pressed = overlay_states_.Test(last_overlay_states_, index);
+
+        if (button.type_ == OverlayButtonType::MENU) {
+            if (button.input_id_ >= 0) {
+                buttons_request_.set((ButtonId) button.input_id_, is_pressed);
+            }
+        } else if (button.type_ == OverlayButtonType::VISIBILITY && is_pressed) {
+            // Toggle the visibility of the overlay for this player
+            overlay_visible_[button.player_] = !overlay_visible_[button.player_];
+        }
+    }
+}
+
+// Prints how quickly pad transitions made it from the SMX SDK to SpiceAPI
+void InputFrame::PrintStats() {
+    printf("[input] transitions sent: %llu, dropped: %llu, latency p50: %.1fus, p99: %.1fus, max: %.1fus\n",
+        (unsigned long long) transition_latency_.count(),
+        (unsigned long long) pad_transitions_dropped_,
+        transition_latency_.percentile(50) / 1000.0,
+        transition_latency_.percentile(99) / 1000.0,
+        transition_latency_.max_value() / 1000.0);
+}
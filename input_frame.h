@@ -0,0 +1,107 @@
+#pragma once
+
+#include "atomic_bitset.h"
+#include "overlay_button.h"
+#include "snapshot_store.h"
+#include "spsc_queue.h"
+#include "spiceapi/metrics.h"
+#include "spiceapi/wrappers.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace spiceapi;
+using namespace std;
+using namespace std::chrono;
+
+// Constants for the panel indices on each pad, these are defined by the StepManiaX SDK
+// left-to-right, top-to-bottom
+#define UP_LEFT 0
+#define UP 1
+#define UP_RIGHT 2
+#define LEFT 3
+#define CENTER 4
+#define RIGHT 5
+#define DOWN_LEFT 6
+#define DOWN 7
+#define DOWN_RIGHT 8
+
+// How many panels each pad has, and so how many distinct panel states there are
+static constexpr size_t kPanelCount = 9;
+static constexpr size_t kPanelStateCount = 1 << kPanelCount;
+
+// The full button state refresh runs off the worker timer, so allow for it ticking slightly early
+static constexpr int kInputRefreshToleranceMs = 1;
+
+// How many pad transitions can be waiting for the input worker before we have to fall back to the latest state
+static constexpr size_t kPadTransitionQueueSize = 256;
+
+// Macro for finding the `i`th bit in an integer, used for reading panel values from the SMX SDK stage states
+#define BIT(value, i) (((value) >> (i)) & 1)
+
+// A change in one pad's panel state, as reported by the SMX SDK
+struct PadTransition {
+    int pad;
+    uint16_t state;
+    uint64_t time_ns;
+};
+
+// The pad state the input worker sends to SpiceAPI, published together by the SMX SDK's thread so the
+// worker always sees one consistent state
+struct InputSnapshot {
+    // Panel bits for each pad, as reported by SMX_GetInputState
+    uint16_t pad_states[2];
+};
+
+// Turns the pad and overlay input states into the buttons requests the input worker sends, one tick at a time.
+// This has no Windows or SMX SDK dependencies, so tools/input_alloc_check can drive the exact same ticks as the
+// input worker against a stand-in server.
+class InputFrame {
+public:
+    InputFrame(SnapshotStore<InputSnapshot>& snapshot, const AtomicBitset<kMaxOverlayButtons>& overlay_states,
+        const vector<OverlayButton>& overlay_buttons, bool (&overlay_visible)[2]);
+
+    void OnPadState(int pad, uint16_t state);
+    void Tick(Connection& con, int refresh_interval_ms);
+    void PrintStats();
+
+private:
+    void ApplyOverlayInputs();
+    void ApplyPadState(size_t player, uint16_t state);
+    bool SendChanges(Connection& con, int refresh_interval_ms);
+    static constexpr array<array<bool, 4>, kPanelStateCount> BuildPanelArrows();
+
+    // Where the inputs come from, which are the globals in the program
+    SnapshotStore<InputSnapshot>& snapshot_;
+    const AtomicBitset<kMaxOverlayButtons>& overlay_states_;
+    const vector<OverlayButton>& overlay_buttons_;
+    bool (&overlay_visible_)[2];
+
+    // Every transition the SMX SDK reported, in order, from its thread to the input worker
+    SpscQueue<PadTransition, kPadTransitionQueueSize> pad_transitions_;
+    // Set when a transition didn't fit in the queue, so the worker resyncs from the latest state instead
+    atomic<bool> pad_transitions_overflowed_{ false };
+    atomic<uint64_t> pad_transitions_dropped_{ 0 };
+    // Time from the SMX SDK reporting a transition until it was sent to SpiceAPI
+    LatencyHistogram transition_latency_;
+    // The overlay button states as of the last run, to find the buttons which changed
+    uint64_t last_overlay_states_ = 0;
+    // Prebuilt request for all our buttons, which just gets its values patched every frame
+    ButtonsWriteRequest buttons_request_;
+    // When the full button state was last sent, in change-driven mode
+    steady_clock::time_point last_refresh_;
+
+    // The SpiceAPI buttons for each panel
+    static constexpr ButtonId kStageInputIds[2][4] = {
+        { BUTTON_P1_PANEL_UP, BUTTON_P1_PANEL_DOWN, BUTTON_P1_PANEL_LEFT, BUTTON_P1_PANEL_RIGHT },
+        { BUTTON_P2_PANEL_UP, BUTTON_P2_PANEL_DOWN, BUTTON_P2_PANEL_LEFT, BUTTON_P2_PANEL_RIGHT },
+    };
+    // The StepManiaX panel indices which correspond to the panel at the same index
+    // in `kStageInputIds` above.
+    static constexpr size_t kPanelIndices[4] = { 1, 7, 3, 5 };
+    // The value of each panel in `kStageInputIds`, for every possible state of a pad's panels
+    static const array<array<bool, 4>, kPanelStateCount> kPanelArrows;
+};
@@ -1,10 +1,5 @@
 #include "input_utils.h"
 
-const string InputUtils::kStageInputNames[2][4] = {
-    { "P1 Panel Up", "P1 Panel Down", "P1 Panel Left", "P1 Panel Right" },
-    { "P2 Panel Up", "P2 Panel Down", "P2 Panel Left", "P2 Panel Right" },
-};
-
 // This is the callback that's actually registered with the StepManiaX SDK. This is separate from the "real"
 // callback with our internal logic, due to how the callback has to be registered and because we store the input
 // as a member variable.
@@ -13,56 +8,33 @@ void InputUtils::SMXStateChangedCallback(int pad, SMXUpdateCallbackReason reason
     pSelf->SmxOnStateChanged(pad);
 }
 
+// Runs on the SMX SDK's thread, which is the only producer for the transition queue. This must never block.
 void InputUtils::SmxOnStateChanged(int pad) {
     // Get the input state (for some reason the callback does not include it as a parameter...)
-    pad_input_states_[pad] = SMXWrapper::getInstance().SMX_GetInputState(pad);
+    uint16_t state = SMXWrapper::getInstance().SMX_GetInputState(pad);
+    frame_.OnPadState(pad, state);
+
+    // Wake up the input worker, so the new state is sent right away
+    SetEvent(input_changed_event);
 }
 
-// Function for sending stage inputs and menu button inputs to SpiceAPI
+// Function for sending stage inputs and menu button inputs to SpiceAPI, on the input worker. The work itself
+// is in InputFrame, which tools/input_alloc_check runs too.
 void InputUtils::PerformMainInputTasks(Connection& con) {
-    // Send a SpiceAPI update with all our button values
-    vector<ButtonState> button_states;
-
-    // Get the stage input values
-    for (size_t player = 0; player < 2; player++) {
-        for (size_t panel = 0; panel < 4; panel++) {
-            ButtonState state;
-            state.name = kStageInputNames[player][panel];
-            state.value = (float) BIT(pad_input_states_[player], kPanelIndices[panel]);
-            button_states.push_back(state);
-        }
-    }
-
-    // Get the touch overlay input values
-    for (OverlayButton& button : touch_overlay_buttons) {
-        bool is_pressed = touch_overlay_button_states[button.id_];
-
-        if (button.type_ == OverlayButtonType::MENU) {
-            ButtonState state;
-            state.name = button.input_name_;
-            state.value = (float) is_pressed;
-            button_states.push_back(state);
-        } else if (button.type_ == OverlayButtonType::VISIBILITY) {
-            if (!is_toggle_pressed[button.player_] && is_pressed) {
-                // Toggle the visibility of the overlay for this player
-                is_overlay_visible[button.player_] = !is_overlay_visible[button.player_];
-            }
-
-            is_toggle_pressed[button.player_] = is_pressed;
-        }
-    }
-
-    // Send the regular button updates + stage updates
-    buttons_write(con, button_states);
+    frame_.Tick(con, input_refresh_interval_ms);
 }
 
-// Function for sending pinpad inputs to SpiceAPI
-void InputUtils::PerformPinpadInputTasks(Connection& con) {
+// Function for queueing pinpad inputs to send to SpiceAPI. This never blocks on the network, the
+// client's I/O thread sends the requests.
+void InputUtils::PerformPinpadInputTasks(AsyncClient& client) {
     vector<char> keys[2];
+    uint64_t pressed = overlay_button_states.Load();
 
     // Get the touch overlay input values
-    for (OverlayButton& button : touch_overlay_buttons) {
-        if (button.type_ == OverlayButtonType::PINPAD && touch_overlay_button_states[button.id_]) {
+    while (pressed != 0) {
+        OverlayButton& button = touch_overlay_buttons[overlay_button_states.PopLowest(pressed)];
+
+        if (button.type_ == OverlayButtonType::PINPAD) {
             char label;
             int player = 0;
 
@@ -81,20 +53,26 @@ void InputUtils::PerformPinpadInputTasks(Connection& con) {
 
     // Handle the pinpad updates
     for (int player = 0; player < 2; player++) {
-        keypads_set(con, player, keys[player]);
+        client.keypads_set(player, move(keys[player]), nullptr);
     }
 }
 
-// Function for sending card-in events to SpiceAPI
-void InputUtils::PerformLoginInputTasks(Connection& con) {
+// Function for queueing card-in events to send to SpiceAPI
+void InputUtils::PerformLoginInputTasks(AsyncClient& client) {
+    uint64_t pressed = overlay_button_states.Load();
+
     // See if the card-in buttons are being pressed
-    for (OverlayButton& button : touch_overlay_buttons) {
-        if (button.type_ == OverlayButtonType::CARD_IN &&
-            touch_overlay_button_states[button.id_]
-        ) {
+    while (pressed != 0) {
+        OverlayButton& button = touch_overlay_buttons[overlay_button_states.PopLowest(pressed)];
+
+        if (button.type_ == OverlayButtonType::CARD_IN) {
             // Handle card-in for this player
-            card_insert(con, button.player_, card_ids[button.player_].c_str());
+            client.card_insert(button.player_, card_ids[button.player_], nullptr);
         }
     }
 }
 
+// Prints how quickly pad transitions made it from the SMX SDK to SpiceAPI
+void InputUtils::PrintStats() {
+    frame_.PrintStats();
+}
@@ -1,47 +1,26 @@
 #pragma once
 
 #include "globals.h"
+#include "input_frame.h"
 #include "smx/smx_wrapper.h"
-#include "spiceapi/wrappers.h"
-#include <array>
+#include "spiceapi/async_client.h"
 #include <string>
 
 using namespace spiceapi;
 using namespace std;
-
-// Constants for the panel indices on each pad, these are defined by the StepManiaX SDK
-// left-to-right, top-to-bottom
-#define UP_LEFT 0
-#define UP 1
-#define UP_RIGHT 2
-#define LEFT 3
-#define CENTER 4
-#define RIGHT 5
-#define DOWN_LEFT 6
-#define DOWN 7
-#define DOWN_RIGHT 8
-
-// Macro for finding the `i`th bit in an integer, used for reading panel values from the SMX SDK stage states
-#define BIT(value, i) (((value) >> (i)) & 1)
+using namespace std::chrono;
 
 class InputUtils {
 public:
     static void SMXStateChangedCallback(int pad, SMXUpdateCallbackReason reason, void* pUser);
     void PerformMainInputTasks(Connection& con);
-    void PerformPinpadInputTasks(Connection& con);
-    void PerformLoginInputTasks(Connection& con);
+    void PerformPinpadInputTasks(AsyncClient& client);
+    void PerformLoginInputTasks(AsyncClient& client);
+    void PrintStats();
 
 private:
     void SmxOnStateChanged(int pad);
 
-    // Buffer to hold our input states
-    array<uint16_t, 2> pad_input_states_;
-    // Keep track of the state of the button to toggle overlay visibility
-    bool is_toggle_pressed[2];
-
-    // The input names that SpiceAPI expects for each panel
-    static const string kStageInputNames[2][4];
-    // The StepManiaX panel indices which correspond to the panel at the same index
-    // in `input_names` above.
-    static constexpr size_t kPanelIndices[4] = { 1, 7, 3, 5 };
+    // The stage and menu inputs sent by the input worker, from the pad and overlay states in the globals
+    InputFrame frame_{ input_snapshot, overlay_button_states, touch_overlay_buttons, is_overlay_visible };
 };
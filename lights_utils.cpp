@@ -2,18 +2,22 @@
 
 // Perform the various lights related tasks on a cadence of 30Hz
 void LightsUtils::PerformLightsTasks(Connection& con) {
-    // Read all the light states from SpiceAPI, for both the regular lights and the tape LEDs
-    light_states_.clear();
-    tape_led_states_.clear();
+    // Read all the light states from SpiceAPI, for both the regular lights and the tape LEDs. Both
+    // requests go out as one pipelined batch, so they only cost a single round trip.
+    light_frame_.valid = false;
+    tape_led_frame_.valid = false;
+    Pipeline pipeline(con);
 
     if (POLL_LIGHTS) {
-        lights_read(con, light_states_);
+        pipeline.lights_read(light_frame_);
     }
 
     if (POLL_TAPE_LED) {
-        ddr_tapeled_get(con, tape_led_states_);
+        pipeline.ddr_tapeled_get(tape_led_frame_);
     }
 
+    pipeline.execute();
+
     if (OUTPUT_LIGHTS) {
         // Output the stage lights first, since those go as a single update to a single API
         HandleStageLightsUpdate();
@@ -29,7 +33,7 @@ void LightsUtils::PerformLightsTasks(Connection& con) {
 // as well as the tape LEDs, since we want the RGB strips and also the corner lights. The StepManiaX
 // SDK accepts one large payload for the lights for all 18 panels at once (both players).
 void LightsUtils::HandleStageLightsUpdate() {
-    if (light_states_.empty() || tape_led_states_.empty())
+    if (!light_frame_.valid || !tape_led_frame_.valid)
         return;
 
     string light_data;
@@ -67,38 +71,40 @@ void LightsUtils::HandleStageLightsUpdate() {
 // Handles the lights updates for an arrow panel of a stage by appending the appropriate
 // lights data to the given string
 void LightsUtils::HandleArrowPanelLight(string& light_data, size_t pad, size_t panel_index) {
-    if (tape_led_states_.empty())
-        return;
+    size_t foot;
 
-    string device_name;
-    string device_prefix = "p" + to_string(pad + 1) + "_foot_";
-
-    // Figure out which device name we need to index on when pulling the LED data
+    // Figure out which device we need to pull the LED data from
     switch (panel_index) {
     case UP:
-        device_name = device_prefix + "up";
+        foot = TAPELED_FOOT_UP;
         break;
     case LEFT:
-        device_name = device_prefix + "left";
+        foot = TAPELED_FOOT_LEFT;
         break;
     case DOWN:
-        device_name = device_prefix + "down";
+        foot = TAPELED_FOOT_DOWN;
         break;
     case RIGHT:
-        device_name = device_prefix + "right";
+        foot = TAPELED_FOOT_RIGHT;
         break;
     default:
         return;
     }
 
     // Pull the LED data for this device, and output it to the light string. All
-    // arrow panel LED PCBs have 25 LEDs, which matches SMX exactly.
-    vector<uint8_t> tapeled = tape_led_states_[device_name];
+    // arrow panel LED PCBs have 25 LEDs, which matches SMX exactly. If the game didn't
+    // send us the whole device, just keep the panel gold so the SMX payload stays aligned.
+    const auto& tapeled = tape_led_frame_.foot[pad][foot];
+
+    if (!tapeled.complete()) {
+        FillStagePanelColor(light_data, kPadRed, kPadGreen, kPadBlue);
+        return;
+    }
 
     for (size_t led = 0; led < kSmxArrowLedCount; led++) {
-        uint8_t r = tapeled[(led * 3)];
-        uint8_t g = tapeled[(led * 3) + 1];
-        uint8_t b = tapeled[(led * 3) + 2];
+        uint8_t r = tapeled.values[(led * 3)];
+        uint8_t g = tapeled.values[(led * 3) + 1];
+        uint8_t b = tapeled.values[(led * 3) + 2];
         AddColor(light_data, r, g, b);
     }
 }
@@ -107,38 +113,37 @@ void LightsUtils::HandleArrowPanelLight(string& light_data, size_t pad, size_t p
 // lights data to the given string based on the given flags (indicating which corner
 // this is for), combined with the incoming lights data from SpiceAPI.
 void LightsUtils::HandleCornerPanelLight(string& light_data, size_t pad, size_t panel_index) {
-    if (light_states_.empty())
+    if (!light_frame_.valid)
         return;
 
-    string device_name;
-    string device_prefix = "GOLD P" + to_string(pad + 1) + " ";
+    size_t corner;
     const uint8_t(*flags)[4] = nullptr;
 
-    // Figure out which device name we need to index on when pulling the LED data, and
+    // Figure out which light we need to index on when pulling the LED data, and
     // also which set of LED flags we should use when constructing the outputs
     switch (panel_index) {
     case UP_LEFT:
-        device_name = device_prefix + "Stage Corner Up-Left";
+        corner = 0;
         flags = kPadUpperLeftLeds;
         break;
     case UP_RIGHT:
-        device_name = device_prefix + "Stage Corner Up-Right";
+        corner = 1;
         flags = kPadUpperRightLeds;
         break;
     case DOWN_LEFT:
-        device_name = device_prefix + "Stage Corner Down-Left";
+        corner = 2;
         flags = kPadLowerLeftLeds;
         break;
     case DOWN_RIGHT:
-        device_name = device_prefix + "Stage Corner Down-Right";
+        corner = 3;
         flags = kPadLowerRightLeds;
         break;
     default:
         return;
     }
 
-    // Read the value of the lights from the given device name
-    uint8_t light_value = light_states_[device_name] * 255.f;
+    // Read the value of the light for this corner
+    uint8_t light_value = light_frame_.values[kStageCornerLightIds[pad][corner]] * 255.f;
 
     // Iterate through the flags and write data based on whether each LED should be lit or not. We are
     // only populating the data for the 4x4 grid of outer LEDs with controllable data. Anything that's
@@ -169,13 +174,10 @@ void LightsUtils::FillStagePanelColor(string& lights_data, uint8_t red, uint8_t
 
 // Handles the lights updates for the marquee
 void LightsUtils::HandleMarqueeLightsUpdate() {
-    if (tape_led_states_.empty())
-        return;
-
     // Read the lights values for the top panel strip
-    vector<uint8_t> tapeled = tape_led_states_["top_panel"];
+    const auto& tapeled = tape_led_frame_.top_panel.values;
 
-    if (tapeled.empty()) {
+    if (!tape_led_frame_.valid || !tape_led_frame_.top_panel.complete()) {
         return;
     }
 
@@ -229,16 +231,16 @@ void LightsUtils::HandleMarqueeLightsUpdate() {
 
 // Handles the lights updates for the vertical strip lights
 void LightsUtils::HandleVerticalStripLightsUpdate() {
-    if (tape_led_states_.empty())
+    if (!tape_led_frame_.valid)
         return;
 
     // Read the lights values for the monitor strips
-    vector<uint8_t> tapeled[2] = {
-        tape_led_states_["monitor_left"],
-        tape_led_states_["monitor_right"]
+    const TapeLedDevice<TAPELED_MONITOR_LED_COUNT>* tapeled[2] = {
+        &tape_led_frame_.monitor_left,
+        &tape_led_frame_.monitor_right
     };
 
-    if (tapeled[0].empty() || tapeled[1].empty())
+    if (!tapeled[0]->complete() || !tapeled[1]->complete())
         return;
 
     static SMXDedicatedCabinetLights device_ids[2] = {
@@ -253,9 +255,9 @@ void LightsUtils::HandleVerticalStripLightsUpdate() {
         for (size_t smx_i = 0; smx_i < kSmxVerticalStripLedCount; smx_i++) {
             // Map the 26 gold cab LEDs to our 28 strip LEDs on SMX
             size_t ddr_i = MapValue(smx_i, 0, kSmxVerticalStripLedCount, kDdrVerticalStripLedCount, 0);
-            uint8_t r = tapeled[strip][(ddr_i * 3)];
-            uint8_t g = tapeled[strip][(ddr_i * 3) + 1];
-            uint8_t b = tapeled[strip][(ddr_i * 3) + 2];
+            uint8_t r = tapeled[strip]->values[(ddr_i * 3)];
+            uint8_t g = tapeled[strip]->values[(ddr_i * 3) + 1];
+            uint8_t b = tapeled[strip]->values[(ddr_i * 3) + 2];
             AddColor(light_data, r, g, b);
         }
 
@@ -269,8 +271,8 @@ void LightsUtils::HandleVerticalStripLightsUpdate() {
 // Handles the lights updates for the 3 spotlights
 void LightsUtils::HandleSpotlightLightsUpdate() {
     // Read the lights values for the subwoofer corner lights
-    uint8_t light1 = light_states_["GOLD P1 Woofer Corner"] * 255.f;
-    uint8_t light2 = light_states_["GOLD P2 Woofer Corner"] * 255.f;
+    uint8_t light1 = light_frame_.values[LIGHT_P1_WOOFER_CORNER] * 255.f;
+    uint8_t light2 = light_frame_.values[LIGHT_P2_WOOFER_CORNER] * 255.f;
     vector<uint8_t> light_values = { light1, light2 };
 
     static SMXDedicatedCabinetLights device_ids[2] = {
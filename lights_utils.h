@@ -5,7 +5,6 @@
 #include "smx/smx_wrapper.h"
 #include "spiceapi/wrappers.h"
 #include <vector>
-#include <map>
 
 #define POLL_TAPE_LED true
 #define POLL_LIGHTS true
@@ -28,9 +27,9 @@ static const size_t kSmxVerticalStripLedCount = 28;
 static const size_t kSmxSpotlightLedCount = 8;
 
 // LED counts for various DDR devices
-static const size_t kDdrArrowLedCount = 25;
-static const size_t kDdrTopPanelLedCount = 40;
-static const size_t kDdrVerticalStripLedCount = 25;
+static const size_t kDdrArrowLedCount = TAPELED_FOOT_LED_COUNT;
+static const size_t kDdrTopPanelLedCount = TAPELED_TOP_PANEL_LED_COUNT;
+static const size_t kDdrVerticalStripLedCount = TAPELED_MONITOR_LED_COUNT;
 
 /*
     Utility class for handling lights output. It basically just exposes a single function to
@@ -51,10 +50,24 @@ private:
     static inline void AddColor(string& lights_data, uint8_t red, uint8_t green, uint8_t blue);
     static inline uint8_t Average(uint8_t a, uint8_t b);
 
-    // The storage for the incoming lights states from Spice API when we call lights::read
-    map<string, float> light_states_;
-    // The storage for the incoming tape LED states from Spice API when we call ddr:tapeled_get
-    map<string, vector<uint8_t>> tape_led_states_;
+    // The storage for the incoming lights states from Spice API when we call lights::read, indexed
+    // by LightId
+    LightFrame light_frame_ = {};
+    // The storage for the incoming tape LED states from Spice API when we call ddr:tapeled_get, which
+    // is decoded into in place every frame
+    TapeLedFrame tape_led_frame_ = {};
+
+    // The stage corner lights for each pad, in up-left, up-right, down-left, down-right order
+    static constexpr LightId kStageCornerLightIds[2][4] = {
+        {
+            LIGHT_P1_STAGE_CORNER_UP_LEFT, LIGHT_P1_STAGE_CORNER_UP_RIGHT,
+            LIGHT_P1_STAGE_CORNER_DOWN_LEFT, LIGHT_P1_STAGE_CORNER_DOWN_RIGHT
+        },
+        {
+            LIGHT_P2_STAGE_CORNER_UP_LEFT, LIGHT_P2_STAGE_CORNER_UP_RIGHT,
+            LIGHT_P2_STAGE_CORNER_DOWN_LEFT, LIGHT_P2_STAGE_CORNER_DOWN_RIGHT
+        }
+    };
 
     /*
         These are just static sets of flags for whether a particular LED is on or off in the outer 4x4
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
+// Most overlay buttons we keep press states for, which is plenty for both players' full set of buttons
+static constexpr size_t kMaxOverlayButtons = 64;
+
 // Enum for different overlay button types
 enum OverlayButtonType {
 	MENU,
@@ -34,4 +38,10 @@ struct OverlayButton {
 	OverlayButtonType type_;
 	// Which player the button is for
 	int player_;
+	// Dense SpiceAPI button ID for `input_name_`, looked up once when the overlay is set up.
+	// This is -1 for buttons which don't map to a SpiceAPI button.
+	int input_id_ = -1;
+	// Dense index of the button's bit in `overlay_button_states`, assigned when the overlay is set up.
+	// This is -1 for buttons past `kMaxOverlayButtons`, which can't be pressed.
+	int state_index_ = -1;
 };
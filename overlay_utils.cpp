@@ -106,9 +106,17 @@ void InitializeTouchOverlay() {
     // Create all the buttons for the overlay
     SetupOverlayButtons();
 
-    // Initialize button states
-    for (OverlayButton& button: touch_overlay_buttons) {
-        touch_overlay_button_states[button.id_] = false;
+    // Resolve the SpiceAPI button IDs up front so the input thread never has to deal with names, and give
+    // every button its bit in the overlay button states. The buttons are stored in order, so their positions
+    // are already dense.
+    if (touch_overlay_buttons.size() > kMaxOverlayButtons) {
+        printf("Too many overlay buttons (%zu), only the first %zu will work\n", touch_overlay_buttons.size(), kMaxOverlayButtons);
+    }
+
+    for (size_t i = 0; i < touch_overlay_buttons.size(); i++) {
+        OverlayButton& button = touch_overlay_buttons[i];
+        button.input_id_ = BUTTON_NAMES.find(button.input_name_);
+        button.state_index_ = (i < kMaxOverlayButtons) ? static_cast<int>(i) : -1;
     }
 
     // Draw static content (buttons in normal state) to the off-screen render targets
@@ -248,10 +256,10 @@ void RenderTouchOverlay() {
     }
 
     // Draw pressed state over buttons that are pressed
-    for (OverlayButton& button : touch_overlay_buttons) {
-        if (touch_overlay_button_states[button.id_]) {
-            DrawSingleButton(button, render_target, true);
-        }
+    uint64_t pressed = overlay_button_states.Load();
+
+    while (pressed != 0) {
+        DrawSingleButton(touch_overlay_buttons[overlay_button_states.PopLowest(pressed)], render_target, true);
     }
 
     render_target->EndDraw();
@@ -285,9 +293,11 @@ void CleanupTouchOverlay() {
 void HandleWindowPress(int x, int y, bool pressed) {
     // Check which buttons the touches are in bounds for
     D2D1_POINT_2F touchPoint = D2D1::Point2F(x, y);
-    for (OverlayButton& button : touch_overlay_buttons) {
-        if (IsTouchInside(button, touchPoint)) {
-            touch_overlay_button_states[button.id_] = pressed;
+
+    for (OverlayButton& button: touch_overlay_buttons) {
+        if (button.state_index_ >= 0 && IsTouchInside(button, touchPoint)) {
+            overlay_button_states.Set(button.state_index_, pressed);
+            SetEvent(input_changed_event);
             return;
         }
     }
@@ -2,6 +2,7 @@
 
 #include "overlay_button.h"
 #include "globals.h"
+#include "spiceapi/names.h"
 
 #include <d2d1.h>
 #include <dwrite.h>
@@ -14,6 +15,7 @@
 #include <vector>
 #include <map>
 
+using namespace spiceapi;
 using namespace std;
 
 struct OverlayButton;
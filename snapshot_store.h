@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+    Seqlock-protected snapshot of a small, trivially copyable struct. Writers publish a whole new copy,
+    and readers always get a consistent copy of one version, never a mix of two, without taking a lock.
+    A read only retries if a write happened to land while it was copying, and writes are rare and tiny
+    compared to reads, so in practice every read is a single pass.
+
+    The data lives in atomic words rather than a plain struct, so readers racing a writer are well-defined.
+    Writers (possibly on several threads) are serialized with a spinlock among themselves, which is only
+    ever held for the copy, so it's fine to update from callbacks on threads we don't own.
+*/
+template<typename T>
+class SnapshotStore {
+    static_assert(std::is_trivially_copyable<T>::value, "SnapshotStore needs a trivially copyable type");
+
+public:
+    SnapshotStore() {
+        Publish();
+    }
+
+    // Returns a consistent copy of the latest published state
+    T Read() const {
+        uint64_t words[kWordCount];
+
+        while (true) {
+            uint32_t before = sequence_.load(std::memory_order_acquire);
+
+            // Odd means a write is in progress
+            if ((before & 1) == 0) {
+                for (size_t i = 0; i < kWordCount; i++) {
+                    words[i] = words_[i].load(std::memory_order_relaxed);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (sequence_.load(std::memory_order_relaxed) == before) {
+                    break;
+                }
+            }
+
+            read_retries_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    // Applies `update` to the latest state and publishes the result
+    template<typename Func>
+    void Update(Func update) {
+        while (write_lock_.test_and_set(std::memory_order_acquire));
+        update(current_);
+        Publish();
+        write_lock_.clear(std::memory_order_release);
+    }
+
+    // How often a read had to retry because it overlapped a write
+    uint64_t GetReadRetries() const { return read_retries_; }
+
+private:
+    static constexpr size_t kWordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // Must be called with the write lock held (or before anyone else can see the store)
+    void Publish() {
+        uint64_t words[kWordCount] = {};
+        memcpy(words, &current_, sizeof(T));
+
+        uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < kWordCount; i++) {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Reader side, shared by every thread which reads
+    alignas(64) std::atomic<uint32_t> sequence_{ 0 };
+    std::array<std::atomic<uint64_t>, kWordCount> words_{};
+    mutable std::atomic<uint64_t> read_retries_{ 0 };
+
+    // Writer side. `current_` is the writers' own copy of the latest state, only touched under the lock.
+    alignas(64) std::atomic_flag write_lock_ = ATOMIC_FLAG_INIT;
+    T current_{};
+};
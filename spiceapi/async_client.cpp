@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include "async_client.h"
+
+const char *spiceapi::priority_name(Priority priority) {
+    switch (priority) {
+        case PRIORITY_MENU:
+            return "menu";
+        case PRIORITY_CARD:
+            return "card";
+        default:
+            return "unknown";
+    }
+}
+
+spiceapi::AsyncClient::AsyncClient(std::string name, Connection &con, size_t queue_size) : con(con) {
+    this->name = name;
+    this->queue_size = queue_size > 0 ? queue_size : 1;
+    this->queue_limits.fill(this->queue_size);
+}
+
+spiceapi::AsyncClient::~AsyncClient() {
+    this->stop();
+}
+
+bool spiceapi::AsyncClient::start() {
+    std::lock_guard<std::mutex> lock(this->queue_mutex);
+    if (this->running)
+        return true;
+    this->running = true;
+    this->connection_lost = false;
+    this->down_since = std::chrono::steady_clock::time_point();
+    this->io_thread = std::thread(&AsyncClient::run, this);
+    return true;
+}
+
+void spiceapi::AsyncClient::stop() {
+
+    // signal the I/O thread, it finishes its current batch first
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        if (!this->running)
+            return;
+        this->running = false;
+    }
+    this->queue_cv.notify_all();
+    if (this->io_thread.joinable())
+        this->io_thread.join();
+
+    // fail everything that never got sent
+    std::array<std::deque<Entry>, PRIORITY_COUNT> remaining;
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        remaining.swap(this->queues);
+        this->queued_total = 0;
+        for (auto &stats : this->class_stats)
+            stats.queue_depth = 0;
+    }
+    for (auto &queue : remaining)
+        for (auto &entry : queue)
+            entry.request(nullptr);
+}
+
+void spiceapi::AsyncClient::set_queue_limit(Priority priority, size_t limit) {
+    std::lock_guard<std::mutex> lock(this->queue_mutex);
+    this->queue_limits[priority] = (std::max)((std::min)(limit, this->queue_size), (size_t) 1);
+}
+
+bool spiceapi::AsyncClient::submit(Request request, Priority priority) {
+    Request displaced;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        if (this->running) {
+            auto &stats = this->class_stats[priority];
+            stats.submitted++;
+
+            // find the request to shed if we're full, either the oldest of this class or of a less urgent one
+            int shed = -1;
+            if (this->queues[priority].size() >= this->queue_limits[priority])
+                shed = priority;
+            else if (this->queued_total >= this->queue_size) {
+                for (int candidate = PRIORITY_COUNT - 1; candidate >= priority && shed < 0; candidate--)
+                    if (!this->queues[candidate].empty())
+                        shed = candidate;
+            }
+            if (shed >= 0) {
+                auto &shed_queue = this->queues[shed];
+                displaced = std::move(shed_queue.front().request);
+                shed_queue.pop_front();
+                this->queued_total--;
+                this->class_stats[shed].queue_depth = shed_queue.size();
+                this->class_stats[shed].dropped++;
+                this->dropped++;
+            }
+
+            // queue unless only more urgent requests are waiting
+            if (this->queued_total < this->queue_size) {
+                auto &queue = this->queues[priority];
+                queue.push_back(Entry{std::move(request), std::chrono::steady_clock::now()});
+                this->queued_total++;
+                this->submitted++;
+                stats.queue_depth = queue.size();
+                if (queue.size() > stats.queue_high_water)
+                    stats.queue_high_water = queue.size();
+                if (this->queued_total > this->queue_high_water)
+                    this->queue_high_water = this->queued_total;
+                queued = true;
+            } else {
+                stats.dropped++;
+                this->dropped++;
+            }
+        }
+    }
+
+    // complete outside of the lock, callbacks may submit again
+    if (displaced)
+        displaced(nullptr);
+    if (!queued) {
+        request(nullptr);
+        return false;
+    }
+    this->queue_cv.notify_one();
+    return true;
+}
+
+/*
+ * Takes up to `limit` requests, most urgent class first. Must be called with the queue locked.
+ */
+size_t spiceapi::AsyncClient::take_batch(std::vector<Request> &batch, size_t limit) {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t priority = 0; priority < PRIORITY_COUNT && batch.size() < limit; priority++) {
+        auto &queue = this->queues[priority];
+        auto &stats = this->class_stats[priority];
+        while (!queue.empty() && batch.size() < limit) {
+
+            // wait time metrics
+            uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - queue.front().queued).count();
+            stats.wait_total_us += wait_us;
+            if (wait_us > stats.wait_max_us)
+                stats.wait_max_us = wait_us;
+            stats.dispatched++;
+
+            batch.push_back(std::move(queue.front().request));
+            queue.pop_front();
+            this->queued_total--;
+        }
+        stats.queue_depth = queue.size();
+    }
+    return batch.size();
+}
+
+/*
+ * Main loop for the I/O thread. Waits for requests, then sends the most urgent ones that are queued as
+ * one pipelined batch, a smaller one while the link is degraded. It also probes the connection's health
+ * every CHECK_INTERVAL_MS.
+ */
+void spiceapi::AsyncClient::run() {
+    std::vector<Request> batch;
+    batch.reserve(BATCH_SIZE_MAX);
+    Pipeline pipeline(this->con);
+    auto last_check = std::chrono::steady_clock::now();
+
+    while (true) {
+
+        // wait for work
+        {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            this->queue_cv.wait_for(lock, std::chrono::milliseconds(CHECK_INTERVAL_MS), [this] {
+                return !this->running || this->queued_total > 0;
+            });
+            if (!this->running)
+                break;
+            this->take_batch(batch, this->con.get_metrics().health.get_state() == LINK_DEGRADED
+                    ? BATCH_SIZE_DEGRADED : BATCH_SIZE_MAX);
+        }
+
+        // send the batch
+        if (!batch.empty()) {
+            for (auto &request : batch)
+                request(&pipeline);
+            pipeline.execute();
+            this->con.idle();
+            batch.clear();
+            this->batches++;
+        }
+
+        /*
+         * probe connection, a dead link gets dropped so the check reconnects it. The connection only
+         * counts as lost once reconnecting has kept failing for the grace period, so a hiccup which got
+         * the link dropped doesn't take the whole program down with it.
+         */
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_check >= std::chrono::milliseconds(CHECK_INTERVAL_MS)) {
+            last_check = now;
+            health_probe(this->con);
+            if (this->con.check()) {
+                this->down_since = std::chrono::steady_clock::time_point();
+                this->connection_lost = false;
+            } else if (this->down_since == std::chrono::steady_clock::time_point()) {
+                this->down_since = now;
+            } else if (now - this->down_since >= std::chrono::milliseconds(CONNECTION_LOST_GRACE_MS)) {
+                this->connection_lost = true;
+            }
+        }
+    }
+}
+
+spiceapi::AsyncClient::Callback spiceapi::AsyncClient::counted(Callback callback) {
+    return [this, callback](bool success) {
+        if (success)
+            this->completed++;
+        else
+            this->failed++;
+        if (callback)
+            callback(success);
+    };
+}
+
+bool spiceapi::AsyncClient::card_insert(size_t index, std::string card_id, Callback callback) {
+    auto done = this->counted(callback);
+    return this->submit([index, card_id, done](Pipeline *pipeline) {
+        if (pipeline == nullptr)
+            return done(false);
+        pipeline->card_insert(index, card_id.c_str());
+        pipeline->on_complete(done);
+    }, PRIORITY_CARD);
+}
+
+bool spiceapi::AsyncClient::keypads_set(unsigned int keypad, std::vector<char> keys, Callback callback) {
+    auto done = this->counted(callback);
+    auto shared_keys = std::make_shared<std::vector<char>>(std::move(keys));
+    return this->submit([keypad, shared_keys, done](Pipeline *pipeline) {
+        if (pipeline == nullptr)
+            return done(false);
+        pipeline->keypads_set(keypad, *shared_keys);
+        pipeline->on_complete(done);
+    }, PRIORITY_MENU);
+}
+
+std::future<bool> spiceapi::AsyncClient::card_insert(size_t index, std::string card_id) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    this->card_insert(index, std::move(card_id), [promise](bool success) { promise->set_value(success); });
+    return future;
+}
+
+std::future<bool> spiceapi::AsyncClient::keypads_set(unsigned int keypad, std::vector<char> keys) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    this->keypads_set(keypad, std::move(keys), [promise](bool success) { promise->set_value(success); });
+    return future;
+}
@@ -0,0 +1,159 @@
+#ifndef SPICEAPI_ASYNC_CLIENT_H
+#define SPICEAPI_ASYNC_CLIENT_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "connection.h"
+#include "wrappers.h"
+
+namespace spiceapi {
+
+    /*
+     * Request priority classes, most urgent first. Stage input and lights polling don't go through the
+     * client: they run on connections and worker threads of their own (see ConnectionSet), so they never
+     * queue behind these.
+     */
+    enum Priority {
+        PRIORITY_MENU,
+        PRIORITY_CARD,
+        PRIORITY_COUNT
+    };
+
+    const char *priority_name(Priority priority);
+
+    /*
+     * Asynchronous client, where one I/O thread owns the connection (and with it the socket and cipher).
+     * Callers only ever enqueue requests and get notified through a callback or future, so they never
+     * block on the network. Queued requests are sent as pipelined batches, taken in priority order, so a
+     * request of a higher class that arrives while a batch is in flight always goes out with the next one.
+     *
+     * Callbacks normally run on the I/O thread, and must not submit and wait on the same client.
+     *
+     * Drop policy: the queue is bounded, in total and per class. If it's full, usually because the game
+     * stopped reading, the oldest request of the lowest class at or below the new one's is dropped to make
+     * room, since requests for newer state supersede older ones. If only more urgent requests are queued,
+     * the new request is dropped instead. Dropped requests complete with false, on the thread whose submit
+     * displaced them. Requests still queued when the client stops complete with false as well.
+     */
+    class AsyncClient {
+    public:
+
+        // adds itself to the given pipeline, or reports failure if the pipeline is null
+        typedef std::function<void(Pipeline *pipeline)> Request;
+        typedef std::function<void(bool success)> Callback;
+
+        // per-class statistics, wait times are from submit until the request is added to a batch
+        struct ClassStats {
+            std::atomic<uint64_t> submitted{0};
+            std::atomic<uint64_t> dropped{0};
+            std::atomic<uint64_t> dispatched{0};
+            std::atomic<size_t> queue_depth{0};
+            std::atomic<size_t> queue_high_water{0};
+            std::atomic<uint64_t> wait_total_us{0};
+            std::atomic<uint64_t> wait_max_us{0};
+        };
+
+    private:
+        static constexpr size_t QUEUE_SIZE_DEFAULT = 64;
+        static constexpr size_t BATCH_SIZE_MAX = 16;
+        static constexpr size_t BATCH_SIZE_DEGRADED = 4;
+        static constexpr int CHECK_INTERVAL_MS = 1000;
+        static constexpr int CONNECTION_LOST_GRACE_MS = 5000;
+
+        struct Entry {
+            Request request;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        std::string name;
+        Connection &con;
+        size_t queue_size;
+        std::array<size_t, PRIORITY_COUNT> queue_limits;
+
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::array<std::deque<Entry>, PRIORITY_COUNT> queues;
+        size_t queued_total = 0;
+        bool running = false;
+        std::thread io_thread;
+        std::array<ClassStats, PRIORITY_COUNT> class_stats;
+        std::chrono::steady_clock::time_point down_since;
+
+        // statistics
+        std::atomic<bool> connection_lost{false};
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> batches{0};
+        std::atomic<size_t> queue_high_water{0};
+
+        void run();
+        size_t take_batch(std::vector<Request> &batch, size_t limit);
+        Callback counted(Callback callback);
+
+    public:
+        AsyncClient(std::string name, Connection &con, size_t queue_size = QUEUE_SIZE_DEFAULT);
+        ~AsyncClient();
+
+        bool start();
+        void stop();
+
+        // limits how many requests of one class may be queued, at most the total queue size
+        void set_queue_limit(Priority priority, size_t limit);
+
+        /*
+         * Queues a request, without blocking on the network. Returns false if the client isn't running
+         * or the request was shed right away, in which case it has already been completed as failed.
+         */
+        bool submit(Request request, Priority priority = PRIORITY_MENU);
+
+        // typed requests, completed through a callback
+        bool card_insert(size_t index, std::string card_id, Callback callback);
+        bool keypads_set(unsigned int keypad, std::vector<char> keys, Callback callback);
+
+        // typed requests, completed through a future
+        std::future<bool> card_insert(size_t index, std::string card_id);
+        std::future<bool> keypads_set(unsigned int keypad, std::vector<char> keys);
+
+        const std::string &get_name() const {
+            return this->name;
+        }
+        bool is_connection_lost() const {
+            return this->connection_lost;
+        }
+        uint64_t get_submitted() const {
+            return this->submitted;
+        }
+        uint64_t get_completed() const {
+            return this->completed;
+        }
+        uint64_t get_failed() const {
+            return this->failed;
+        }
+        uint64_t get_dropped() const {
+            return this->dropped;
+        }
+        uint64_t get_batches() const {
+            return this->batches;
+        }
+        size_t get_queue_high_water() const {
+            return this->queue_high_water;
+        }
+        const ClassStats &get_class_stats(Priority priority) const {
+            return this->class_stats[priority];
+        }
+    };
+}
+
+#endif //SPICEAPI_ASYNC_CLIENT_H
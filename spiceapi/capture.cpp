@@ -0,0 +1,241 @@
+#include "capture.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace spiceapi {
+
+    static const size_t CAPTURE_ALIGNMENT = 8;
+    static const size_t CAPTURE_FILE_BUFFER_SIZE = 1 << 20;
+    static const size_t CAPTURE_PENDING_RESERVE = 1 << 20;
+    static const size_t CAPTURE_PENDING_MAX = 64 << 20;
+    static const size_t CAPTURE_FLUSH_SIZE = 64 << 10;
+    static const int CAPTURE_FLUSH_INTERVAL_MS = 100;
+
+    static inline size_t capture_padded(size_t length) {
+        return (length + CAPTURE_ALIGNMENT - 1) & ~(CAPTURE_ALIGNMENT - 1);
+    }
+}
+
+spiceapi::CaptureWriter::CaptureWriter(const std::string &path) {
+    this->start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+    if (fopen_s(&this->file, path.c_str(), "wb") != 0)
+        this->file = nullptr;
+#else
+    this->file = fopen(path.c_str(), "wb");
+#endif
+    if (this->file == nullptr)
+        return;
+    setvbuf(this->file, nullptr, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+    // header
+    CaptureFileHeader header{};
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.record_header_size = sizeof(CaptureRecordHeader);
+    header.start_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    if (fwrite(&header, sizeof(header), 1, this->file) != 1) {
+        fclose(this->file);
+        this->file = nullptr;
+        return;
+    }
+
+    this->pending.reserve(CAPTURE_PENDING_RESERVE);
+    this->writer = std::thread(&CaptureWriter::write_loop, this);
+}
+
+spiceapi::CaptureWriter::~CaptureWriter() {
+    if (this->writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->pending_ready.notify_one();
+        this->writer.join();
+    }
+    if (this->file != nullptr)
+        fclose(this->file);
+}
+
+void spiceapi::CaptureWriter::record(uint8_t channel, CaptureDirection direction, const void *data, size_t size) {
+    static const uint8_t padding[CAPTURE_ALIGNMENT] = {};
+    if (this->file == nullptr)
+        return;
+
+    // the timestamp is taken before locking so it's as close to the message as possible
+    CaptureRecordHeader header{};
+    header.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - this->start).count();
+    header.length = (uint32_t) size;
+    header.direction = direction;
+    header.channel = channel;
+    size_t record_size = sizeof(header) + capture_padded(size);
+
+    // append to the pending buffer, the writer thread does the actual writing
+    bool flush;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->pending.size() + record_size > CAPTURE_PENDING_MAX) {
+            this->dropped++;
+            return;
+        }
+        auto header_bytes = (const uint8_t *) &header;
+        this->pending.insert(this->pending.end(), header_bytes, header_bytes + sizeof(header));
+        this->pending.insert(this->pending.end(), (const uint8_t *) data, (const uint8_t *) data + size);
+        this->pending.insert(this->pending.end(), padding, padding + capture_padded(size) - size);
+        flush = this->pending.size() >= CAPTURE_FLUSH_SIZE;
+    }
+    this->records++;
+
+    // otherwise the writer picks it up on its next interval
+    if (flush)
+        this->pending_ready.notify_one();
+}
+
+void spiceapi::CaptureWriter::write_loop() {
+
+    // swapped with the pending buffer, so both keep their capacity
+    std::vector<uint8_t> writing;
+    writing.reserve(CAPTURE_PENDING_RESERVE);
+
+    bool stop = false;
+    while (!stop) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->pending_ready.wait_for(lock, std::chrono::milliseconds(CAPTURE_FLUSH_INTERVAL_MS), [this] {
+                return this->stopping || this->pending.size() >= CAPTURE_FLUSH_SIZE;
+            });
+            stop = this->stopping;
+            writing.swap(this->pending);
+        }
+        if (!writing.empty()) {
+            fwrite(writing.data(), 1, writing.size(), this->file);
+            writing.clear();
+        }
+    }
+    fflush(this->file);
+}
+
+spiceapi::CaptureReader::~CaptureReader() {
+    this->close();
+}
+
+bool spiceapi::CaptureReader::open(const std::string &path) {
+    this->close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    this->file_handle = file;
+    this->mapping_handle = mapping;
+    this->data = (const uint8_t *) view;
+    this->size = (size_t) file_size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    madvise(view, (size_t) file_stat.st_size, MADV_SEQUENTIAL);
+    this->data = (const uint8_t *) view;
+    this->size = (size_t) file_stat.st_size;
+#endif
+
+    // check header
+    auto header = (const CaptureFileHeader *) this->data;
+    if (this->size < sizeof(CaptureFileHeader)
+            || memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != CAPTURE_VERSION
+            || header->record_header_size != sizeof(CaptureRecordHeader)) {
+        this->close();
+        return false;
+    }
+
+    this->rewind();
+    return true;
+}
+
+void spiceapi::CaptureReader::unmap() {
+    if (this->data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(this->data);
+    CloseHandle((HANDLE) this->mapping_handle);
+    CloseHandle((HANDLE) this->file_handle);
+    this->mapping_handle = nullptr;
+    this->file_handle = nullptr;
+#else
+    munmap((void *) this->data, this->size);
+#endif
+    this->data = nullptr;
+}
+
+void spiceapi::CaptureReader::close() {
+    this->unmap();
+    this->size = 0;
+    this->position = 0;
+}
+
+uint64_t spiceapi::CaptureReader::get_start_time_ns() const {
+    if (this->data == nullptr)
+        return 0;
+    return ((const CaptureFileHeader *) this->data)->start_time_ns;
+}
+
+bool spiceapi::CaptureReader::next(CaptureRecord &record) {
+    if (this->data == nullptr || this->size - this->position < sizeof(CaptureRecordHeader))
+        return false;
+
+    // the payload must fit, a capture which was cut off ends at the last complete record
+    auto header = (const CaptureRecordHeader *) (this->data + this->position);
+    if (this->size - this->position - sizeof(CaptureRecordHeader) < header->length)
+        return false;
+
+    record.time_ns = header->time_ns;
+    record.direction = (CaptureDirection) header->direction;
+    record.channel = header->channel;
+    record.data = std::string_view(
+            (const char *) this->data + this->position + sizeof(CaptureRecordHeader), header->length);
+    this->position += sizeof(CaptureRecordHeader) + capture_padded(header->length);
+    if (this->position > this->size)
+        this->position = this->size;
+    return true;
+}
+
+void spiceapi::CaptureReader::rewind() {
+    this->position = sizeof(CaptureFileHeader);
+}
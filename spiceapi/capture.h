@@ -0,0 +1,135 @@
+#ifndef SPICEAPI_CAPTURE_H
+#define SPICEAPI_CAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace spiceapi {
+
+    /*
+     * Capture file format. Everything is little-endian, and laid out so the file can be memory-mapped and
+     * walked without copying:
+     *
+     *   file header  CaptureFileHeader
+     *   records      CaptureRecordHeader, then `length` payload bytes, padded to a multiple of 8
+     *
+     * Payloads are the decrypted messages without their null terminator. Record times are nanoseconds
+     * since the capture started, from the steady clock.
+     */
+    static const char CAPTURE_MAGIC[8] = {'S', 'P', 'I', 'C', 'E', 'C', 'A', 'P'};
+    static const uint32_t CAPTURE_VERSION = 1;
+
+    enum CaptureDirection : uint8_t {
+        CAPTURE_REQUEST = 0,
+        CAPTURE_RESPONSE = 1
+    };
+
+    struct CaptureFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_header_size;
+        uint64_t start_time_ns; // wall clock, since the unix epoch
+    };
+
+    struct CaptureRecordHeader {
+        uint64_t time_ns;
+        uint32_t length;
+        uint8_t direction;
+        uint8_t channel; // which connection the message was on
+        uint16_t reserved;
+    };
+
+    static_assert(sizeof(CaptureFileHeader) == 24, "capture file header must be packed");
+    static_assert(sizeof(CaptureRecordHeader) == 16, "capture record header must be packed");
+
+    /*
+     * Appends messages to a capture file. Several connections can share one writer from different threads.
+     *
+     * Recording only copies the message into a pending buffer, so it's cheap enough for the input thread.
+     * A writer thread swaps that buffer out and writes it to the file, which is where the I/O happens. If
+     * the writer falls too far behind, new records are dropped instead of growing the buffer forever.
+     */
+    class CaptureWriter {
+    private:
+        FILE *file = nullptr;
+        std::chrono::steady_clock::time_point start;
+        std::atomic<uint64_t> records{0};
+        std::atomic<uint64_t> dropped{0};
+
+        std::mutex mutex;
+        std::condition_variable pending_ready;
+        std::vector<uint8_t> pending;
+        bool stopping = false;
+        std::thread writer;
+
+        void write_loop();
+
+    public:
+        explicit CaptureWriter(const std::string &path);
+        CaptureWriter(const CaptureWriter &) = delete;
+        CaptureWriter &operator=(const CaptureWriter &) = delete;
+        ~CaptureWriter();
+
+        bool is_open() const {
+            return this->file != nullptr;
+        }
+        uint64_t get_records() const {
+            return this->records;
+        }
+        uint64_t get_dropped() const {
+            return this->dropped;
+        }
+
+        void record(uint8_t channel, CaptureDirection direction, const void *data, size_t size);
+    };
+
+    struct CaptureRecord {
+        uint64_t time_ns;
+        CaptureDirection direction;
+        uint8_t channel;
+        std::string_view data;
+    };
+
+    /*
+     * Reads a capture file through a read-only memory mapping. Record data points into the mapping, and
+     * stays valid for as long as the reader is open.
+     */
+    class CaptureReader {
+    private:
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        size_t position = 0;
+#ifdef _WIN32
+        void *file_handle = nullptr;
+        void *mapping_handle = nullptr;
+#endif
+
+        void unmap();
+
+    public:
+        CaptureReader() = default;
+        CaptureReader(const CaptureReader &) = delete;
+        CaptureReader &operator=(const CaptureReader &) = delete;
+        ~CaptureReader();
+
+        bool open(const std::string &path);
+        void close();
+
+        uint64_t get_start_time_ns() const;
+
+        // returns false at the end of the file, or if the rest of it is truncated
+        bool next(CaptureRecord &record);
+        void rewind();
+    };
+}
+
+#endif //SPICEAPI_CAPTURE_H
@@ -1,26 +1,43 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <ws2tcpip.h>
 #include "connection.h"
 
 namespace spiceapi {
 
     // settings
-    static const size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
-    static const int RECEIVE_TIMEOUT = 1000;
+    static const size_t RECEIVE_CHUNK_SIZE = 4 * 1024;
+    static const size_t MESSAGE_SIZE_MAX = 16 * 1024 * 1024;
+    static const size_t PARSE_VALUE_ARENA_SIZE = 64 * 1024;
+    static const size_t PARSE_STACK_ARENA_SIZE = 16 * 1024;
+    static const int TIMEOUT_DEFAULT = 1000;
+    static const int STALE_TIMEOUT = 2000;
+    static const int CONNECT_TIMEOUT = 500;
+    static const int KEEPALIVE_IDLE = 2000;
+    static const int KEEPALIVE_INTERVAL = 500;
+    static const int RECONNECT_DELAY_MIN = 50;
+    static const int RECONNECT_DELAY_MAX = 2000;
+    static const char UNIX_HOST_PREFIX[] = "unix:";
+
+    static_assert(sizeof(sockaddr_un) <= sizeof(sockaddr_storage), "unix address doesn't fit");
 }
 
-spiceapi::Connection::Connection(std::string host, uint16_t port, std::string password) {
-    this->host = host;
-    this->port = port;
+spiceapi::Connection::Connection(std::string host, uint16_t port, std::string password) :
+        parse_value_buffer(PARSE_VALUE_ARENA_SIZE),
+        parse_stack_buffer(PARSE_STACK_ARENA_SIZE),
+        parse_value_allocator(parse_value_buffer.data(), parse_value_buffer.size()),
+        parse_stack_allocator(parse_stack_buffer.data(), parse_stack_buffer.size()),
+        response_document(&parse_value_allocator, PARSE_STACK_ARENA_SIZE / 4, &parse_stack_allocator) {
     this->password = password;
-    this->socket = INVALID_SOCKET;
+    this->socket = SOCKET_INVALID;
     this->cipher = nullptr;
+    this->timeout_ms = TIMEOUT_DEFAULT;
+    this->reconnect_random.seed(std::random_device()());
+    this->change_host(host, port);
 
-    // WSA startup
-    WSADATA wsa_data;
-    int error = WSAStartup(MAKEWORD(2, 2), &wsa_data);
-    if (error) {
-        std::cerr << "Failed to start WSA: " << error << std::endl;
+    // socket startup
+    if (!socket_startup()) {
+        std::cerr << "Failed to start sockets: " << socket_error() << std::endl;
         exit(1);
     }
 }
@@ -28,11 +45,12 @@ spiceapi::Connection::Connection(std::string host, uint16_t port, std::string pa
 spiceapi::Connection::~Connection() {
 
     // clean up
+    this->close();
     if (this->cipher != nullptr)
         delete this->cipher;
 
-    // cleanup WSA
-    WSACleanup();
+    // cleanup sockets
+    socket_cleanup();
 }
 
 void spiceapi::Connection::cipher_alloc() {
@@ -52,66 +70,160 @@ void spiceapi::Connection::cipher_alloc() {
 }
 
 bool spiceapi::Connection::check() {
-    int result = 0;
 
     // check if socket is invalid
-    if (this->socket == INVALID_SOCKET) {
-
-        // get all addresses
-        addrinfo *addr_list;
-        addrinfo hints{};
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_protocol = IPPROTO_TCP;
-        if ((result = getaddrinfo(
-                this->host.c_str(),
-                std::to_string(this->port).c_str(),
-                &hints,
-                &addr_list))) {
-            std::cerr << "getaddrinfo failed: " << result << std::endl;
+    if (this->socket == SOCKET_INVALID) {
+
+        // wait for the backoff
+        auto now = std::chrono::steady_clock::now();
+        if (now < this->reconnect_next)
+            return false;
+
+        // connect
+        this->connect_attempts++;
+        if (!this->connect_address()) {
+
+            // back off exponentially, with jitter so several connections don't retry in lockstep
+            this->reconnect_delay = (std::min)(
+                    (std::max)(this->reconnect_delay * 2, RECONNECT_DELAY_MIN), RECONNECT_DELAY_MAX);
+            std::uniform_int_distribution<int> jitter(this->reconnect_delay * 3 / 4, this->reconnect_delay * 5 / 4);
+            this->reconnect_next = now + std::chrono::milliseconds(jitter(this->reconnect_random));
             return false;
         }
 
-        // check all addresses
-        for (addrinfo *addr = addr_list; addr != NULL; addr = addr->ai_next) {
+        // connection successful
+        this->receive_start = 0;
+        this->receive_end = 0;
+        this->cipher_alloc();
+        this->reconnect_delay = 0;
+        this->metrics.health.reset();
+        this->connects++;
+        this->last_connect_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - this->disconnected_since).count();
+    }
 
-            // try open socket
-            this->socket = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-            if (this->socket == INVALID_SOCKET) {
-                std::cerr << "socket failed: " << WSAGetLastError() << std::endl;
-                freeaddrinfo(addr_list);
-                return false;
-            }
+    // socket probably still valid
+    return true;
+}
 
-            // try connect
-            result = connect(this->socket, addr->ai_addr, (int) addr->ai_addrlen);
-            if (result == SOCKET_ERROR) {
-                closesocket(this->socket);
-                this->socket = INVALID_SOCKET;
-                continue;
-            }
+void spiceapi::Connection::idle() {
+    if (this->cipher != nullptr)
+        this->cipher->refill();
+}
 
-            // configure socket
-            int opt_val;
-            opt_val = 1;
-            setsockopt(this->socket, IPPROTO_TCP, TCP_NODELAY, (const char*) &opt_val, sizeof(opt_val));
-            opt_val = RECEIVE_TIMEOUT;
-            setsockopt(this->socket, SOL_SOCKET, SO_RCVTIMEO, (const char*) &opt_val, sizeof(opt_val));
+int spiceapi::Connection::reconnect_wait_ms() const {
+    if (this->socket != SOCKET_INVALID)
+        return 0;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            this->reconnect_next - std::chrono::steady_clock::now()).count();
+    return wait > 0 ? (int) wait : 0;
+}
 
-            // connection successful
-            this->cipher_alloc();
-            break;
+/*
+ * Resolves the host into the address cache. Unix socket paths are just copied into an address.
+ */
+bool spiceapi::Connection::resolve() {
+    this->addresses.clear();
+    this->address_preferred = 0;
+
+    // unix socket
+    if (!this->unix_path.empty()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (this->unix_path.length() >= sizeof(addr.sun_path)) {
+            std::cerr << "unix socket path too long: " << this->unix_path << std::endl;
+            return false;
         }
+        memcpy(addr.sun_path, this->unix_path.c_str(), this->unix_path.length() + 1);
+        Address address{};
+        memcpy(&address.addr, &addr, sizeof(addr));
+        address.length = sizeof(addr);
+        this->addresses.push_back(address);
+        return true;
+    }
+
+    // get all addresses
+    int result;
+    addrinfo *addr_list;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if ((result = getaddrinfo(
+            this->host.c_str(),
+            std::to_string(this->port).c_str(),
+            &hints,
+            &addr_list))) {
+        std::cerr << "getaddrinfo failed: " << result << std::endl;
+        return false;
+    }
+    for (addrinfo *addr = addr_list; addr != NULL; addr = addr->ai_next) {
+        if (addr->ai_addrlen > sizeof(sockaddr_storage))
+            continue;
+        Address address{};
+        memcpy(&address.addr, addr->ai_addr, addr->ai_addrlen);
+        address.length = addr->ai_addrlen;
+        this->addresses.push_back(address);
+    }
+    freeaddrinfo(addr_list);
+    return !this->addresses.empty();
+}
+
+/*
+ * Tries every cached address once, starting with the one that worked last.
+ */
+bool spiceapi::Connection::connect_address() {
+
+    // resolve once, the result is kept across attempts
+    if (this->addresses.empty() && !this->resolve())
+        return false;
 
-        // check if successful
-        freeaddrinfo(addr_list);
-        if (this->socket == INVALID_SOCKET) {
+    for (size_t i = 0; i < this->addresses.size(); i++) {
+        size_t index = (this->address_preferred + i) % this->addresses.size();
+        auto &address = this->addresses[index];
+        int family = address.addr.ss_family;
+
+        // try open socket
+        this->socket = socket_open(family, SOCK_STREAM, family == AF_UNIX ? 0 : IPPROTO_TCP);
+        if (this->socket == SOCKET_INVALID) {
+            std::cerr << "socket failed: " << socket_error() << std::endl;
             return false;
         }
+
+        // try connect
+        if (!socket_connect(this->socket, (const sockaddr *) &address.addr, address.length, CONNECT_TIMEOUT)) {
+            socket_close(this->socket);
+            this->socket = SOCKET_INVALID;
+            continue;
+        }
+
+        // configure socket
+        if (family != AF_UNIX) {
+            socket_set_nodelay(this->socket, true);
+            socket_set_keepalive(this->socket, KEEPALIVE_IDLE, KEEPALIVE_INTERVAL);
+        }
+        this->address_preferred = index;
+        return true;
     }
 
-    // socket probably still valid
-    return true;
+    return false;
+}
+
+void spiceapi::Connection::change_host(std::string host, uint16_t port) {
+    this->close();
+    this->host = host;
+    this->port = port;
+    this->addresses.clear();
+    this->reconnect_delay = 0;
+    this->reconnect_next = std::chrono::steady_clock::time_point();
+    this->disconnected_since = std::chrono::steady_clock::now();
+
+    // check for unix socket path
+    const size_t prefix_len = sizeof(UNIX_HOST_PREFIX) - 1;
+    if (host.compare(0, prefix_len, UNIX_HOST_PREFIX) == 0)
+        this->unix_path = host.substr(prefix_len);
+    else
+        this->unix_path.clear();
 }
 
 void spiceapi::Connection::change_pass(std::string password) {
@@ -119,63 +231,361 @@ void spiceapi::Connection::change_pass(std::string password) {
     this->cipher_alloc();
 }
 
-std::string spiceapi::Connection::request(std::string json) {
+void spiceapi::Connection::set_capture(CaptureWriter *capture, uint8_t channel) {
+    this->capture = capture;
+    this->capture_channel = channel;
+}
+
+void spiceapi::Connection::set_timeout(int timeout_ms) {
+    this->timeout_ms = timeout_ms;
+}
+
+std::string_view spiceapi::Connection::request(std::string_view json, int timeout_ms) {
+
+    // send request and wait for its response, both within the same deadline
+    auto deadline = this->deadline_from(timeout_ms);
+    if (!this->send_message(json, deadline))
+        return std::string_view();
+    size_t offset, length;
+    if (!this->receive_stale(deadline) || !this->receive_message(offset, length, deadline)) {
+        this->abandon(1);
+        return std::string_view();
+    }
+
+    // return resulting json
+    return std::string_view(&this->receive_buffer[offset], length);
+}
+
+/*
+ * Sends all requests with a single write and then collects one response per request, so the whole
+ * batch costs one round trip. Responses are returned in the order they arrive, callers match them up
+ * by their message IDs. Batches are limited to PIPELINE_REQUESTS_MAX requests and, with more than one
+ * request, PIPELINE_BYTES_MAX bytes.
+ *
+ * The RC4 stream is shared between both directions, so the requests are crypted back-to-back as one
+ * block and the responses are decrypted in arrival order. This only matches the server side if it reads
+ * the whole batch before answering, which is why it goes out in one send and is kept small enough to
+ * arrive in one read. If the server answered part of the batch first anyway, both sides are out of step
+ * and the responses decrypt to garbage. So anything short of one well-formed response per request
+ * (a timeout, the connection closing, or a response which isn't a JSON object) drops the connection,
+ * since the next connect starts a fresh cipher, and the batch fails with no responses at all.
+ */
+bool spiceapi::Connection::request_pipelined(const std::vector<std::string_view> &requests,
+        std::vector<std::string_view> &responses, int timeout_ms) {
+    auto deadline = this->deadline_from(timeout_ms);
+    responses.clear();
+
+    // check batch
+    size_t batch_len = 0;
+    for (auto &json : requests)
+        batch_len += json.length() + 1;
+    if (batch_len == 0)
+        return true;
+    if (requests.size() > PIPELINE_REQUESTS_MAX || (requests.size() > 1 && batch_len > PIPELINE_BYTES_MAX))
+        return false;
 
     // check connection
-    if (!this->check())
-        return "";
+    if (!this->check() || !this->send_ready(deadline))
+        return false;
+
+    // concatenate all null-terminated requests
+    if (this->send_buffer.size() < batch_len)
+        this->send_buffer.resize(batch_len);
+    size_t batch_pos = 0;
+    for (auto &json : requests) {
+        if (this->capture != nullptr)
+            this->capture->record(this->capture_channel, CAPTURE_REQUEST, json.data(), json.length());
+        memcpy(&this->send_buffer[batch_pos], json.data(), json.length());
+        batch_pos += json.length();
+        this->send_buffer[batch_pos++] = 0;
+    }
 
     // crypt
-    auto json_len = strlen(json.c_str()) + 1;
-    uint8_t* json_data = new uint8_t[json_len];
-    memcpy(json_data, json.c_str(), json_len);
-    if (this->cipher != nullptr)
-        this->cipher->crypt(json_data, json_len);
+    this->crypt(this->send_buffer.data(), batch_len);
+
+    // send
+    this->receive_compact();
+    if (!this->send_data(this->send_buffer.data(), batch_len))
+        return false;
+
+    // skip responses to earlier requests which we gave up on
+    if (!this->receive_stale(deadline)) {
+        this->abandon(requests.size());
+        return false;
+    }
+
+    // receive one response per request, the buffer may move while receiving so views are made after
+    size_t first = this->receive_start;
+    for (size_t received = 0; received < requests.size(); received++) {
+        size_t offset, length;
+        if (!this->receive_message(offset, length, deadline)) {
+            if (this->socket != SOCKET_INVALID)
+                this->timeouts++;
+            this->close();
+            return false;
+        }
+        if (length < 2 || this->receive_buffer[offset] != '{' || this->receive_buffer[offset + length - 1] != '}') {
+            this->close();
+            return false;
+        }
+    }
+    size_t offset = first;
+    for (size_t i = 0; i < requests.size(); i++) {
+        const char *message = &this->receive_buffer[offset];
+        size_t length = strlen(message);
+        responses.emplace_back(message, length);
+        offset += length + 1;
+    }
+
+    return true;
+}
+
+bool spiceapi::Connection::request_send(std::string_view json, int timeout_ms) {
+    return this->send_message(json, this->deadline_from(timeout_ms));
+}
+
+bool spiceapi::Connection::send_message(std::string_view json, Deadline deadline) {
+
+    // check connection
+    if (!this->check() || !this->send_ready(deadline))
+        return false;
+
+    // copy into our send buffer with null terminator
+    auto json_len = json.length() + 1;
+    if (this->send_buffer.size() < json_len)
+        this->send_buffer.resize(json_len);
+    memcpy(this->send_buffer.data(), json.data(), json.length());
+    this->send_buffer[json.length()] = 0;
+    if (this->capture != nullptr)
+        this->capture->record(this->capture_channel, CAPTURE_REQUEST, json.data(), json.length());
+
+    // crypt
+    this->crypt(this->send_buffer.data(), json_len);
 
     // send
-    auto send_result = send(this->socket, (const char*) json_data, (int) json_len, 0);
-    delete[] json_data;
-    if (send_result == SOCKET_ERROR || send_result < (int) json_len) {
-        closesocket(this->socket);
-        this->socket = INVALID_SOCKET;
-        return "";
-    }
-
-    // receive
-    uint8_t receive_data[RECEIVE_BUFFER_SIZE];
-    size_t receive_data_len = 0;
-    int receive_result;
-    while ((receive_result = recv(
-            this->socket,
-            (char*) &receive_data[receive_data_len],
-            sizeof(receive_data) - receive_data_len, 0)) > 0) {
-
-        // check for buffer overflow
-        if (receive_data_len + receive_result >= sizeof(receive_data)) {
-            closesocket(this->socket);
-            this->socket = INVALID_SOCKET;
-            return "";
+    this->receive_compact();
+    if (!this->send_data(this->send_buffer.data(), json_len))
+        return false;
+
+    return true;
+}
+
+bool spiceapi::Connection::response_receive(std::string_view &json, int timeout_ms) {
+    auto deadline = this->deadline_from(timeout_ms);
+    size_t offset, length;
+    if (!this->receive_stale(deadline) || !this->receive_message(offset, length, deadline)) {
+        this->abandon(1);
+        return false;
+    }
+    json = std::string_view(&this->receive_buffer[offset], length);
+    return true;
+}
+
+spiceapi::Connection::Deadline spiceapi::Connection::deadline_from(int timeout_ms) const {
+    if (timeout_ms < 0)
+        timeout_ms = this->timeout_ms;
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+}
+
+/*
+ * Makes sure a new request can be sent. With a cipher, every abandoned response has to be received
+ * (and decrypted) first so both sides stay at the same keystream position. Without one, they're just
+ * skipped when receiving.
+ */
+bool spiceapi::Connection::send_ready(Deadline deadline) {
+    if (this->cipher == nullptr)
+        return true;
+    return this->receive_stale(deadline);
+}
+
+/*
+ * Receives and drops abandoned responses. If the server still hasn't answered them a while after they
+ * were abandoned, it's considered hung and the connection is closed, which also resets the cipher.
+ */
+bool spiceapi::Connection::receive_stale(Deadline deadline) {
+    while (this->stale_responses > 0) {
+        size_t offset, length;
+        if (!this->receive_message(offset, length, deadline)) {
+            if (this->socket != SOCKET_INVALID
+                    && std::chrono::steady_clock::now() - this->stale_since
+                            >= std::chrono::milliseconds(STALE_TIMEOUT))
+                this->close();
+            return false;
+        }
+        this->stale_responses--;
+        this->stale_discarded++;
+    }
+    return true;
+}
+
+void spiceapi::Connection::abandon(size_t count) {
+    if (this->socket == SOCKET_INVALID || count == 0)
+        return;
+    if (this->stale_responses == 0)
+        this->stale_since = std::chrono::steady_clock::now();
+    this->stale_responses += count;
+    this->timeouts++;
+}
+
+spiceapi::ResponseDocument *spiceapi::Connection::response_parse(std::string_view json) {
+
+    // the response must live in our receive buffer, since it's parsed in place
+    char *data = this->receive_data(json);
+    if (data == nullptr)
+        return nullptr;
+
+    // reset arena, values from the last response are dropped without being freed
+    this->response_document.SetNull();
+    this->parse_value_allocator.Clear();
+    this->parse_stack_allocator.Clear();
+
+    // parse document
+    this->response_document.ParseInsitu(data);
+    if (this->response_document.HasParseError())
+        return nullptr;
+
+    return &this->response_document;
+}
+
+/*
+ * Returns a writable pointer to a response which lives in our receive buffer, or null if the view
+ * doesn't point at a null-terminated message in there.
+ */
+char *spiceapi::Connection::receive_data(std::string_view json) {
+    if (json.empty() || this->receive_buffer.empty()
+            || json.data() < this->receive_buffer.data()
+            || json.data() + json.length() >= this->receive_buffer.data() + this->receive_end)
+        return nullptr;
+    return &this->receive_buffer[json.data() - this->receive_buffer.data()];
+}
+
+/*
+ * Receives the next null-terminated message into the receive buffer, and returns its position. Any bytes
+ * past the message end belong to the next response, and stay in the buffer for the next call.
+ *
+ * Running into the deadline keeps the connection open, since the message may still arrive later.
+ */
+bool spiceapi::Connection::receive_message(size_t &offset, size_t &length, Deadline deadline) {
+
+    // check connection
+    if (this->socket == SOCKET_INVALID)
+        return false;
+
+    size_t search_pos = this->receive_start;
+    while (true) {
+
+        // check for a complete message
+        if (search_pos < this->receive_end) {
+            auto end = (const char *) memchr(
+                    &this->receive_buffer[search_pos], 0, this->receive_end - search_pos);
+            if (end != nullptr) {
+                offset = this->receive_start;
+                length = end - &this->receive_buffer[offset];
+                this->receive_start = offset + length + 1;
+                if (this->capture != nullptr)
+                    this->capture->record(this->capture_channel, CAPTURE_RESPONSE, &this->receive_buffer[offset], length);
+                return true;
+            }
+            search_pos = this->receive_end;
+        }
+
+        // check for runaway message
+        if (this->receive_end - this->receive_start >= MESSAGE_SIZE_MAX) {
+            this->close();
+            return false;
+        }
+
+        // grow buffer if needed
+        if (this->receive_buffer.size() < this->receive_end + RECEIVE_CHUNK_SIZE)
+            this->receive_buffer.resize((std::max)(
+                    this->receive_buffer.size() * 2, this->receive_end + RECEIVE_CHUNK_SIZE));
+
+        /*
+         * wait for data until the deadline, rounded up to whole milliseconds for poll, since
+         * truncating would turn a 2ms timeout into anything between 0 and 1ms
+         */
+        auto remaining_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        int remaining_ms = remaining_us > 0 ? (int) ((remaining_us + 999) / 1000) : 0;
+        int poll_result = socket_poll(this->socket, SOCKET_POLL_READ, remaining_ms);
+        if (poll_result == 0)
+            return false;
+        if (poll_result < 0) {
+            this->close();
+            return false;
+        }
+
+        // receive
+        int receive_result = socket_receive(
+                this->socket,
+                &this->receive_buffer[this->receive_end],
+                this->receive_buffer.size() - this->receive_end);
+        if (receive_result <= 0) {
+
+            // receive error
+            this->close();
+            return false;
         }
 
         // crypt
-        if (this->cipher != nullptr)
-            this->cipher->crypt(&receive_data[receive_data_len], (size_t) receive_result);
+        this->crypt((uint8_t *) &this->receive_buffer[this->receive_end], (size_t) receive_result);
 
         // increase received data length
-        receive_data_len += receive_result;
+        this->receive_end += receive_result;
+    }
+}
+
+/*
+ * Moves any unconsumed received bytes to the front of the buffer. Only called before sending a new request,
+ * since that's when views to earlier responses are allowed to become invalid.
+ */
+void spiceapi::Connection::receive_compact() {
+    if (this->receive_start == 0)
+        return;
+    auto remaining = this->receive_end - this->receive_start;
+    if (remaining > 0)
+        memmove(&this->receive_buffer[0], &this->receive_buffer[this->receive_start], remaining);
+    this->receive_start = 0;
+    this->receive_end = remaining;
+}
 
-        // check for message end
-        if (receive_data[receive_data_len - 1] == 0)
-            break;
+/*
+ * Sends everything, since a stream socket may accept less than the full buffer in one call. The data is
+ * already crypted, so on failure the connection is closed as the cipher state can't be recovered.
+ */
+bool spiceapi::Connection::send_data(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        int send_result = socket_send(this->socket, data, size);
+        if (send_result <= 0) {
+            this->close();
+            return false;
+        }
+        data += send_result;
+        size -= send_result;
     }
+    return true;
+}
 
-    // return resulting json
-    if (receive_data_len > 0) {
-        return std::string((const char *) &receive_data[0], receive_data_len - 1);
-    } else {
+void spiceapi::Connection::disconnect() {
+    this->close();
+}
+
+void spiceapi::Connection::crypt(uint8_t *data, size_t size) {
+    if (this->cipher == nullptr)
+        return;
+    auto start = metrics_now();
+    this->cipher->crypt(data, size);
+    this->metrics.crypt.record(metrics_now() - start);
+    this->metrics.crypt_bytes += size;
+}
 
-        // receive error
-        this->socket = INVALID_SOCKET;
-        return "";
+void spiceapi::Connection::close() {
+    if (this->socket != SOCKET_INVALID) {
+        socket_close(this->socket);
+        this->socket = SOCKET_INVALID;
+        this->disconnected_since = std::chrono::steady_clock::now();
     }
+    this->receive_start = 0;
+    this->receive_end = 0;
+    this->stale_responses = 0;
 }
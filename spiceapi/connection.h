@@ -3,29 +3,209 @@
 
 //#pragma comment(lib, "ws2_32.lib")
 
+#include <atomic>
+#include <chrono>
+#include <random>
 #include <string>
-#include <winsock2.h>
+#include <string_view>
+#include <vector>
+#include "capture.h"
+#include "metrics.h"
 #include "rc4.h"
+#include "socket.h"
+#include "../rapidjson/document.h"
 
 namespace spiceapi {
 
+    /*
+     * Document type used for parsing responses. Both the values and the parser stack come from memory
+     * pools owned by the connection, which are reset between responses instead of being freed.
+     */
+    typedef rapidjson::GenericDocument<rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>,
+            rapidjson::MemoryPoolAllocator<>> ResponseDocument;
+
+    /*
+     * A connection to SpiceAPI. The host can either be a TCP host name, or "unix:<path>" to connect over
+     * an AF_UNIX stream socket instead (Windows 10 1803+ and POSIX), in which case the port is ignored.
+     * The framing and RC4 layer are the same for both.
+     *
+     * Reconnects back off exponentially with some jitter, so check() returns false right away while the
+     * next attempt isn't due yet. Resolved addresses are cached until the host changes, and connects
+     * time out instead of blocking.
+     *
+     * Every request has a deadline, the connection's timeout unless given. A response which misses it is
+     * abandoned, and discarded when it arrives later. The RC4 state is shared by both directions, so with
+     * a cipher the next request waits (within its own deadline) for abandoned responses to be drained
+     * before it's sent, otherwise both sides would crypt with different keystream positions.
+     */
     class Connection {
     private:
         std::string host;
         uint16_t port;
         std::string password;
-        SOCKET socket;
+        std::string unix_path;
+        socket_t socket;
         RC4* cipher;
 
+        // resolved addresses, the one which connected last is tried first
+        struct Address {
+            sockaddr_storage addr;
+            size_t length;
+        };
+        std::vector<Address> addresses;
+        size_t address_preferred = 0;
+
+        // reconnect state
+        std::chrono::steady_clock::time_point reconnect_next;
+        std::chrono::steady_clock::time_point disconnected_since;
+        int reconnect_delay = 0;
+        std::minstd_rand reconnect_random;
+        std::atomic<uint64_t> connect_attempts{0};
+        std::atomic<uint64_t> connects{0};
+        std::atomic<uint64_t> last_connect_time_ms{0};
+
+        // deadlines, and responses which missed theirs but are still owed by the server
+        typedef std::chrono::steady_clock::time_point Deadline;
+        int timeout_ms;
+        size_t stale_responses = 0;
+        Deadline stale_since;
+        std::atomic<uint64_t> timeouts{0};
+        std::atomic<uint64_t> stale_discarded{0};
+
+        // timings and counters, read by anyone while the owning thread records
+        ConnectionMetrics metrics;
+
+        // optional traffic capture, shared with other connections
+        CaptureWriter *capture = nullptr;
+        uint8_t capture_channel = 0;
+
+        // persistent buffers, which only ever grow so steady-state requests don't allocate
+        std::vector<uint8_t> send_buffer;
+        std::vector<char> receive_buffer;
+        size_t receive_start = 0;
+        size_t receive_end = 0;
+
+        // response parsing arena
+        std::vector<char> parse_value_buffer;
+        std::vector<char> parse_stack_buffer;
+        rapidjson::MemoryPoolAllocator<> parse_value_allocator;
+        rapidjson::MemoryPoolAllocator<> parse_stack_allocator;
+        ResponseDocument response_document;
+        rapidjson::Reader response_reader;
+
         void cipher_alloc();
+        bool resolve();
+        bool connect_address();
+        void close();
+        bool send_data(const uint8_t *data, size_t size);
+        bool send_message(std::string_view json, Deadline deadline);
+        bool send_ready(Deadline deadline);
+        Deadline deadline_from(int timeout_ms) const;
+        char *receive_data(std::string_view json);
+        void receive_compact();
+        bool receive_message(size_t &offset, size_t &length, Deadline deadline);
+        bool receive_stale(Deadline deadline);
+        void abandon(size_t count);
+        void crypt(uint8_t *data, size_t size);
 
     public:
+        /*
+         * Limits for request_pipelined. A batch has to reach the server in one read, see there, and one
+         * page is the smallest read buffer a server is likely to use. A single request can be any size.
+         */
+        static constexpr size_t PIPELINE_REQUESTS_MAX = 16;
+        static constexpr size_t PIPELINE_BYTES_MAX = 4096;
+
         Connection(std::string host, uint16_t port, std::string password = "");
         ~Connection();
 
         bool check();
+        // drops the connection, the next check() reconnects
+        void disconnect();
+        // housekeeping between requests, like topping up the cipher's keystream
+        void idle();
+        void change_host(std::string host, uint16_t port);
+
+        ConnectionMetrics &get_metrics() {
+            return this->metrics;
+        }
+        const ConnectionMetrics &get_metrics() const {
+            return this->metrics;
+        }
+
+        // records every decrypted request and response to the writer, null to stop
+        void set_capture(CaptureWriter *capture, uint8_t channel);
+
+        // default timeout for requests on this connection, in milliseconds
+        void set_timeout(int timeout_ms);
+        int get_timeout() const {
+            return this->timeout_ms;
+        }
+        uint64_t get_timeouts() const {
+            return this->timeouts;
+        }
+        uint64_t get_stale_discarded() const {
+            return this->stale_discarded;
+        }
+
+        // milliseconds until the next reconnect attempt is allowed, 0 if connected or due
+        int reconnect_wait_ms() const;
+        uint64_t get_connect_attempts() const {
+            return this->connect_attempts;
+        }
+        uint64_t get_connects() const {
+            return this->connects;
+        }
+        // time from losing (or first wanting) the connection until it was established, for the last connect
+        uint64_t get_last_connect_time_ms() const {
+            return this->last_connect_time_ms;
+        }
+
         void change_pass(std::string password);
-        std::string request(std::string json);
+
+        /*
+         * Responses are returned as views into the connection's receive buffer. They stay valid until
+         * the next request on this connection, and are always followed by a null terminator. A timeout
+         * of -1 uses the connection's timeout.
+         */
+        std::string_view request(std::string_view json, int timeout_ms = -1);
+        // sends a batch in one write, see PIPELINE_REQUESTS_MAX and PIPELINE_BYTES_MAX for its limits
+        bool request_pipelined(const std::vector<std::string_view> &requests,
+                std::vector<std::string_view> &responses, int timeout_ms = -1);
+
+        bool request_send(std::string_view json, int timeout_ms = -1);
+        bool response_receive(std::string_view &json, int timeout_ms = -1);
+
+        /*
+         * Parses a response returned by this connection in place, on top of the receive buffer. The
+         * document is owned by the connection and stays valid until the next request or parse.
+         */
+        ResponseDocument *response_parse(std::string_view json);
+
+        /*
+         * Streams a response returned by this connection through a SAX handler, in place on top of the
+         * receive buffer. This skips building a document entirely.
+         */
+        template<typename Handler>
+        bool response_parse(std::string_view json, Handler &handler) {
+            char *data = this->receive_data(json);
+            if (data == nullptr)
+                return false;
+            rapidjson::InsituStringStream stream(data);
+            return !this->response_reader.Parse<rapidjson::kParseInsituFlag>(stream, handler).IsError();
+        }
+
+        /*
+         * Streams a response through a SAX handler without modifying it, so it can still be parsed
+         * afterwards. The handler can return false to stop early once it has what it needs.
+         */
+        template<typename Handler>
+        bool response_scan(std::string_view json, Handler &handler) {
+            if (this->receive_data(json) == nullptr)
+                return false;
+            rapidjson::StringStream stream(json.data());
+            return !this->response_reader.Parse(stream, handler).IsError();
+        }
 
     };
 }
@@ -0,0 +1,105 @@
+#include "metrics.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#include <intrin.h>
+#endif
+
+namespace spiceapi {
+
+    static inline int log2_floor(uint64_t value) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return (int) index;
+#elif defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int index = 0;
+        while (value >>= 1)
+            index++;
+        return index;
+#endif
+    }
+}
+
+/*
+ * Values below 2 * SUB_BUCKETS get a bucket each, above that the exponent picks the group of buckets
+ * and the next SUB_BUCKET_BITS bits below the leading one pick the bucket within it.
+ */
+size_t spiceapi::LatencyHistogram::bucket_index(uint64_t value) {
+    if (value < SUB_BUCKETS * 2)
+        return (size_t) value;
+    int exponent = log2_floor(value);
+    if (exponent > EXPONENT_MAX)
+        return BUCKET_COUNT - 1;
+    size_t sub_bucket = (size_t) (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t spiceapi::LatencyHistogram::bucket_upper(size_t index) {
+    if (index < SUB_BUCKETS * 2)
+        return index;
+    int exponent = (int) (index / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % SUB_BUCKETS;
+    int shift = exponent - SUB_BUCKET_BITS;
+    return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t spiceapi::LatencyHistogram::mean() const {
+    uint64_t count = this->count();
+    return count > 0 ? this->sum.load(std::memory_order_relaxed) / count : 0;
+}
+
+uint64_t spiceapi::LatencyHistogram::percentile(double percentile) const {
+    uint64_t count = this->count();
+    if (count == 0)
+        return 0;
+
+    // walk the buckets until we've seen enough values
+    uint64_t target = (uint64_t) (count * percentile / 100.0 + 0.5);
+    if (target < 1)
+        target = 1;
+    uint64_t seen = 0;
+    for (size_t index = 0; index < BUCKET_COUNT; index++) {
+        seen += this->buckets[index].load(std::memory_order_relaxed);
+        if (seen >= target) {
+
+            // the last bucket also holds everything out of range
+            uint64_t max = this->max_value();
+            uint64_t upper = index < BUCKET_COUNT - 1 ? bucket_upper(index) : max;
+            return upper < max ? upper : max;
+        }
+    }
+    return this->max_value();
+}
+
+const char *spiceapi::link_state_name(LinkState state) {
+    switch (state) {
+        case LINK_HEALTHY:
+            return "healthy";
+        case LINK_DEGRADED:
+            return "degraded";
+        case LINK_DEAD:
+            return "dead";
+        case LINK_UNKNOWN:
+        default:
+            return "unknown";
+    }
+}
+
+const char *spiceapi::endpoint_name(Endpoint endpoint) {
+    switch (endpoint) {
+        case ENDPOINT_BUTTONS_WRITE:
+            return "buttons write";
+        case ENDPOINT_CARD_INSERT:
+            return "card insert";
+        case ENDPOINT_KEYPADS_SET:
+            return "keypads set";
+        case ENDPOINT_LIGHTS_READ:
+            return "lights read";
+        case ENDPOINT_DDR_TAPELED_GET:
+            return "ddr tapeled_get";
+        default:
+            return "unknown";
+    }
+}
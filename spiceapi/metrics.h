@@ -0,0 +1,143 @@
+#ifndef SPICEAPI_METRICS_H
+#define SPICEAPI_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace spiceapi {
+
+    /*
+     * Lock-free log-linear histogram for durations in nanoseconds, in the style of HdrHistogram. Every
+     * power of two is split into 16 buckets, so recorded values keep about 6% precision from 32ns up to
+     * about a minute. Recording is a few relaxed atomic adds, so it can stay on in production, and it can
+     * be read from any thread while others record.
+     */
+    class LatencyHistogram {
+    private:
+        static constexpr int SUB_BUCKET_BITS = 4;
+        static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int EXPONENT_MAX = 36;
+        static constexpr size_t BUCKET_COUNT = (EXPONENT_MAX - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + SUB_BUCKETS;
+
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> maximum{0};
+
+        static size_t bucket_index(uint64_t value);
+        static uint64_t bucket_upper(size_t index);
+
+    public:
+        void record(uint64_t value) {
+            this->buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+            this->total.fetch_add(1, std::memory_order_relaxed);
+            this->sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t current = this->maximum.load(std::memory_order_relaxed);
+            while (value > current && !this->maximum.compare_exchange_weak(current, value, std::memory_order_relaxed));
+        }
+
+        uint64_t count() const {
+            return this->total.load(std::memory_order_relaxed);
+        }
+        uint64_t max_value() const {
+            return this->maximum.load(std::memory_order_relaxed);
+        }
+        uint64_t mean() const;
+
+        // the value below which `percentile` percent of the recorded values fall, rounded up to its bucket
+        uint64_t percentile(double percentile) const;
+    };
+
+    /*
+     * The module/function pairs the hot paths use. Everything else isn't tracked.
+     */
+    enum Endpoint {
+        ENDPOINT_BUTTONS_WRITE,
+        ENDPOINT_CARD_INSERT,
+        ENDPOINT_KEYPADS_SET,
+        ENDPOINT_LIGHTS_READ,
+        ENDPOINT_DDR_TAPELED_GET,
+        ENDPOINT_COUNT
+    };
+
+    const char *endpoint_name(Endpoint endpoint);
+
+    /*
+     * Per-endpoint timings and counters. Round trip is from sending until the response is back (for
+     * pipelined requests, until the whole batch is back), serialize covers building the request JSON and
+     * parse covers decoding the response. Byte counts include the null terminators.
+     */
+    struct EndpointMetrics {
+        LatencyHistogram round_trip;
+        LatencyHistogram serialize;
+        LatencyHistogram parse;
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> bytes_out{0};
+        std::atomic<uint64_t> bytes_in{0};
+    };
+
+    enum LinkState {
+        LINK_UNKNOWN,
+        LINK_HEALTHY,
+        LINK_DEGRADED,
+        LINK_DEAD
+    };
+
+    const char *link_state_name(LinkState state);
+
+    /*
+     * Result of the periodic health probes on a connection (see health_probe() in wrappers.h). The
+     * state is what schedulers look at to back off, the rest is for diagnostics.
+     */
+    struct LinkHealth {
+        std::atomic<LinkState> state{LINK_UNKNOWN};
+        LatencyHistogram rtt;
+        std::atomic<uint64_t> last_rtt_ns{0};
+        std::atomic<uint64_t> probes{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> degraded{0};
+        std::atomic<uint64_t> dead{0};
+
+        // only touched by the thread which probes
+        uint32_t consecutive_failures = 0;
+
+        LinkState get_state() const {
+            return this->state.load(std::memory_order_relaxed);
+        }
+
+        // a new connection starts out unknown again, until it's been probed
+        void reset() {
+            this->state = LINK_UNKNOWN;
+            this->consecutive_failures = 0;
+        }
+    };
+
+    /*
+     * Everything measured on one connection. Crypting runs on whole batches and socket reads, so it's
+     * tracked for the connection rather than per endpoint.
+     */
+    struct ConnectionMetrics {
+        std::array<EndpointMetrics, ENDPOINT_COUNT> endpoints;
+        LatencyHistogram crypt;
+        std::atomic<uint64_t> crypt_bytes{0};
+        LinkHealth health;
+
+        EndpointMetrics &operator[](Endpoint endpoint) {
+            return this->endpoints[endpoint];
+        }
+        const EndpointMetrics &operator[](Endpoint endpoint) const {
+            return this->endpoints[endpoint];
+        }
+    };
+
+    inline uint64_t metrics_now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+#endif //SPICEAPI_METRICS_H
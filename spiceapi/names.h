@@ -0,0 +1,195 @@
+#ifndef SPICEAPI_NAMES_H
+#define SPICEAPI_NAMES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace spiceapi {
+
+    /*
+     * Seeded FNV-1a hash, used to build the perfect hash tables below at compile time.
+     */
+    constexpr uint32_t name_hash(std::string_view name, uint32_t seed) {
+        uint32_t hash = 2166136261u ^ seed;
+        for (size_t i = 0; i < name.length(); i++) {
+            hash ^= (uint8_t) name[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    /*
+     * Fixed set of names with a perfect hash, so names coming from SpiceAPI can be turned into dense
+     * integer IDs with one hash and one compare. The seed is searched for at compile time, names which
+     * aren't in the table are rejected by the compare.
+     */
+    template<size_t Count, size_t Slots>
+    class NameTable {
+    private:
+        static_assert(Count < 0xFF, "too many names for 8-bit slots");
+        static_assert(Slots >= Count && (Slots & (Slots - 1)) == 0, "slot count must be a power of two");
+        static const uint8_t EMPTY = 0xFF;
+        static const uint32_t SEED_SEARCH_MAX = 4096;
+
+        std::array<std::string_view, Count> names;
+        std::array<uint8_t, Slots> slots;
+        uint32_t seed;
+        bool perfect;
+
+        constexpr bool try_seed(uint32_t candidate) {
+            for (size_t slot = 0; slot < Slots; slot++)
+                slots[slot] = EMPTY;
+            for (size_t id = 0; id < Count; id++) {
+                auto slot = name_hash(names[id], candidate) & (Slots - 1);
+                if (slots[slot] != EMPTY)
+                    return false;
+                slots[slot] = (uint8_t) id;
+            }
+            return true;
+        }
+
+    public:
+        constexpr explicit NameTable(const std::array<std::string_view, Count> &names)
+                : names(names), slots(), seed(0), perfect(false) {
+            for (uint32_t candidate = 0; candidate < SEED_SEARCH_MAX && !perfect; candidate++) {
+                if (try_seed(candidate)) {
+                    seed = candidate;
+                    perfect = true;
+                }
+            }
+        }
+
+        constexpr bool valid() const {
+            return perfect;
+        }
+
+        constexpr size_t size() const {
+            return Count;
+        }
+
+        // returns the ID for a name, or -1 if it's not in the table
+        constexpr int find(std::string_view name) const {
+            uint8_t id = slots[name_hash(name, seed) & (Slots - 1)];
+            return (id != EMPTY && names[id] == name) ? id : -1;
+        }
+
+        constexpr std::string_view name(size_t id) const {
+            return names[id];
+        }
+
+        constexpr const char *c_str(size_t id) const {
+            return names[id].data();
+        }
+    };
+
+    /*
+     * Every light, button and tape LED name used with the DDR gold cabinet profile. The ID enums must
+     * stay in the same order as their name tables.
+     */
+    enum LightId {
+        LIGHT_P1_STAGE_CORNER_UP_LEFT,
+        LIGHT_P1_STAGE_CORNER_UP_RIGHT,
+        LIGHT_P1_STAGE_CORNER_DOWN_LEFT,
+        LIGHT_P1_STAGE_CORNER_DOWN_RIGHT,
+        LIGHT_P2_STAGE_CORNER_UP_LEFT,
+        LIGHT_P2_STAGE_CORNER_UP_RIGHT,
+        LIGHT_P2_STAGE_CORNER_DOWN_LEFT,
+        LIGHT_P2_STAGE_CORNER_DOWN_RIGHT,
+        LIGHT_P1_WOOFER_CORNER,
+        LIGHT_P2_WOOFER_CORNER,
+        LIGHT_COUNT
+    };
+
+    inline constexpr NameTable<LIGHT_COUNT, 64> LIGHT_NAMES({
+        "GOLD P1 Stage Corner Up-Left",
+        "GOLD P1 Stage Corner Up-Right",
+        "GOLD P1 Stage Corner Down-Left",
+        "GOLD P1 Stage Corner Down-Right",
+        "GOLD P2 Stage Corner Up-Left",
+        "GOLD P2 Stage Corner Up-Right",
+        "GOLD P2 Stage Corner Down-Left",
+        "GOLD P2 Stage Corner Down-Right",
+        "GOLD P1 Woofer Corner",
+        "GOLD P2 Woofer Corner",
+    });
+
+    enum ButtonId {
+        BUTTON_P1_PANEL_UP,
+        BUTTON_P1_PANEL_DOWN,
+        BUTTON_P1_PANEL_LEFT,
+        BUTTON_P1_PANEL_RIGHT,
+        BUTTON_P2_PANEL_UP,
+        BUTTON_P2_PANEL_DOWN,
+        BUTTON_P2_PANEL_LEFT,
+        BUTTON_P2_PANEL_RIGHT,
+        BUTTON_P1_MENU_UP,
+        BUTTON_P1_MENU_DOWN,
+        BUTTON_P1_MENU_LEFT,
+        BUTTON_P1_MENU_RIGHT,
+        BUTTON_P1_START,
+        BUTTON_P2_MENU_UP,
+        BUTTON_P2_MENU_DOWN,
+        BUTTON_P2_MENU_LEFT,
+        BUTTON_P2_MENU_RIGHT,
+        BUTTON_P2_START,
+        BUTTON_COUNT
+    };
+
+    inline constexpr NameTable<BUTTON_COUNT, 128> BUTTON_NAMES({
+        "P1 Panel Up",
+        "P1 Panel Down",
+        "P1 Panel Left",
+        "P1 Panel Right",
+        "P2 Panel Up",
+        "P2 Panel Down",
+        "P2 Panel Left",
+        "P2 Panel Right",
+        "P1 Menu Up",
+        "P1 Menu Down",
+        "P1 Menu Left",
+        "P1 Menu Right",
+        "P1 Start",
+        "P2 Menu Up",
+        "P2 Menu Down",
+        "P2 Menu Left",
+        "P2 Menu Right",
+        "P2 Start",
+    });
+
+    enum TapeLedId {
+        TAPELED_P1_FOOT_UP,
+        TAPELED_P1_FOOT_RIGHT,
+        TAPELED_P1_FOOT_LEFT,
+        TAPELED_P1_FOOT_DOWN,
+        TAPELED_P2_FOOT_UP,
+        TAPELED_P2_FOOT_RIGHT,
+        TAPELED_P2_FOOT_LEFT,
+        TAPELED_P2_FOOT_DOWN,
+        TAPELED_TOP_PANEL,
+        TAPELED_MONITOR_LEFT,
+        TAPELED_MONITOR_RIGHT,
+        TAPELED_COUNT
+    };
+
+    inline constexpr NameTable<TAPELED_COUNT, 64> TAPELED_NAMES({
+        "p1_foot_up",
+        "p1_foot_right",
+        "p1_foot_left",
+        "p1_foot_down",
+        "p2_foot_up",
+        "p2_foot_right",
+        "p2_foot_left",
+        "p2_foot_down",
+        "top_panel",
+        "monitor_left",
+        "monitor_right",
+    });
+
+    static_assert(LIGHT_NAMES.valid(), "no perfect hash seed found for light names");
+    static_assert(BUTTON_NAMES.valid(), "no perfect hash seed found for button names");
+    static_assert(TAPELED_NAMES.valid(), "no perfect hash seed found for tape LED names");
+}
+
+#endif //SPICEAPI_NAMES_H
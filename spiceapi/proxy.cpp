@@ -0,0 +1,313 @@
+#include "proxy.h"
+#include <cstring>
+#include "wrappers.h"
+#include "../rapidjson/document.h"
+#include "../rapidjson/stringbuffer.h"
+#include "../rapidjson/writer.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+namespace spiceapi {
+
+    static const size_t PROXY_RECEIVE_CHUNK = 4096;
+    static const size_t PROXY_REQUEST_SIZE_MAX = 1 << 20;
+
+    static inline std::string value2str(const rapidjson::Value &value) {
+        rapidjson::StringBuffer sb;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+        value.Accept(writer);
+        return std::string(sb.GetString(), sb.GetSize());
+    }
+
+    /*
+     * Finds the digits of the ID in a response. spice2x always writes it first, so only the start of the
+     * message is searched.
+     */
+    static bool response_id_span(std::string_view json, size_t &begin, size_t &end) {
+        auto key = json.substr(0, 32).find("\"id\"");
+        if (key == std::string_view::npos)
+            return false;
+        size_t pos = key + 4;
+        while (pos < json.length() && (json[pos] == ' ' || json[pos] == ':'))
+            pos++;
+        begin = pos;
+        while (pos < json.length() && json[pos] >= '0' && json[pos] <= '9')
+            pos++;
+        end = pos;
+        return end > begin;
+    }
+
+    static inline void response_error(std::string &out, const std::string &id, const char *error) {
+        out = "{\"id\":" + id + ",\"errors\":[\"" + error + "\"],\"data\":[]}";
+        out.push_back('\0');
+    }
+
+    static bool send_all(socket_t sock, const char *data, size_t size) {
+        while (size > 0) {
+            int result = socket_send(sock, data, size);
+            if (result <= 0)
+                return false;
+            data += result;
+            size -= result;
+        }
+        return true;
+    }
+}
+
+spiceapi::Proxy::Proxy(Connection &upstream, std::string password)
+        : upstream(upstream), password(std::move(password)) {
+}
+
+spiceapi::Proxy::~Proxy() {
+    this->stop();
+}
+
+bool spiceapi::Proxy::start(uint16_t port) {
+    if (this->running)
+        return true;
+
+    // listen on loopback
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    this->listener = socket_open(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (this->listener == SOCKET_INVALID)
+        return false;
+    int reuse = 1;
+    setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+    if (bind(this->listener, (const sockaddr *) &addr, sizeof(addr)) != 0 || listen(this->listener, 16) != 0) {
+        socket_close(this->listener);
+        this->listener = SOCKET_INVALID;
+        return false;
+    }
+
+    this->running = true;
+    this->listener_thread = std::thread(&Proxy::accept_loop, this);
+    return true;
+}
+
+void spiceapi::Proxy::stop() {
+    if (!this->running)
+        return;
+    this->running = false;
+
+    // every thread polls with a timeout, so they all notice on their own
+    if (this->listener_thread.joinable())
+        this->listener_thread.join();
+    socket_close(this->listener);
+    this->listener = SOCKET_INVALID;
+    std::lock_guard<std::mutex> lock(this->clients_mutex);
+    for (auto &client : this->clients)
+        client->thread.join();
+    this->clients.clear();
+}
+
+void spiceapi::Proxy::set_cache_ttl(int ttl_ms) {
+    this->cache_ttl = std::chrono::milliseconds(ttl_ms);
+}
+
+void spiceapi::Proxy::accept_loop() {
+    while (this->running) {
+        if (socket_poll(this->listener, SOCKET_POLL_READ, POLL_INTERVAL_MS) <= 0)
+            continue;
+        socket_t sock = accept(this->listener, nullptr, nullptr);
+        if (sock == SOCKET_INVALID)
+            continue;
+        socket_set_nodelay(sock, true);
+        this->accepted++;
+
+        // start session, and clean up the ones which ended
+        std::lock_guard<std::mutex> lock(this->clients_mutex);
+        for (auto it = this->clients.begin(); it != this->clients.end();) {
+            if ((*it)->done) {
+                (*it)->thread.join();
+                it = this->clients.erase(it);
+            } else {
+                it++;
+            }
+        }
+        auto client = std::make_unique<Client>();
+        client->socket = sock;
+        client->thread = std::thread(&Proxy::serve, this, client.get());
+        this->clients.push_back(std::move(client));
+    }
+}
+
+void spiceapi::Proxy::serve(Client *client) {
+    std::unique_ptr<RC4> cipher;
+    if (!this->password.empty())
+        cipher = std::make_unique<RC4>((uint8_t *) this->password.c_str(), this->password.length());
+
+    std::vector<char> buffer;
+    size_t buffer_end = 0;
+    std::string response;
+    bool ok = true;
+    while (ok && this->running) {
+
+        // receive
+        int ready = socket_poll(client->socket, SOCKET_POLL_READ, POLL_INTERVAL_MS);
+        if (ready == 0)
+            continue;
+        if (buffer.size() < buffer_end + PROXY_RECEIVE_CHUNK)
+            buffer.resize(buffer_end + PROXY_RECEIVE_CHUNK);
+        int received = ready < 0 ? -1 : socket_receive(client->socket, &buffer[buffer_end], buffer.size() - buffer_end);
+        if (received <= 0)
+            break;
+        if (cipher)
+            cipher->crypt((uint8_t *) &buffer[buffer_end], (size_t) received);
+        buffer_end += received;
+
+        // answer every complete request
+        size_t start = 0;
+        while (ok) {
+            auto end = (const char *) memchr(&buffer[start], 0, buffer_end - start);
+            if (end == nullptr)
+                break;
+            this->handle(&buffer[start], response);
+            start = end - buffer.data() + 1;
+            if (cipher)
+                cipher->crypt((uint8_t *) response.data(), response.size());
+            ok = send_all(client->socket, response.data(), response.size());
+        }
+
+        // keep the partial request, unless it's grown beyond anything sane
+        memmove(buffer.data(), &buffer[start], buffer_end - start);
+        buffer_end -= start;
+        if (buffer_end > PROXY_REQUEST_SIZE_MAX)
+            ok = false;
+    }
+
+    socket_close(client->socket);
+    client->done = true;
+}
+
+/*
+ * Answers one request, with the null terminator included in `out`.
+ */
+void spiceapi::Proxy::handle(const char *json, std::string &out) {
+    this->requests++;
+
+    // parse
+    rapidjson::Document doc;
+    doc.Parse(json);
+    if (doc.HasParseError() || !doc.IsObject()
+            || !doc.HasMember("id") || !doc["id"].IsUint64()
+            || !doc.HasMember("module") || !doc["module"].IsString()
+            || !doc.HasMember("function") || !doc["function"].IsString()) {
+        this->errors++;
+        response_error(out, "0", "invalid request");
+        return;
+    }
+    auto id = std::to_string(doc["id"].GetUint64());
+    std::string_view module(doc["module"].GetString(), doc["module"].GetStringLength());
+    std::string_view function(doc["function"].GetString(), doc["function"].GetStringLength());
+    bool cacheable = (module == "lights" && function == "read") || (module == "ddr" && function == "tapeled_get");
+    std::string key;
+    if (cacheable) {
+        key.append(module).append(1, ' ').append(function);
+        if (doc.HasMember("params"))
+            key.append(1, ' ').append(value2str(doc["params"]));
+    }
+
+    // forward with our own ID, so it can't collide with other clients' or our own requests
+    doc["id"].SetUint64(msg_gen_id());
+    auto request = value2str(doc);
+    auto response = cacheable ? this->forward_cached(key, request) : this->forward(request);
+    if (!response) {
+        this->errors++;
+        response_error(out, id, "upstream unavailable");
+        return;
+    }
+
+    // patch in the client's ID
+    out.assign(response->json, 0, response->id_begin);
+    out.append(id);
+    out.append(response->json, response->id_end, std::string::npos);
+    out.push_back('\0');
+}
+
+spiceapi::Proxy::ResponsePtr spiceapi::Proxy::forward(std::string_view json) {
+    std::lock_guard<std::mutex> lock(this->upstream_mutex);
+    this->forwarded++;
+    if (!this->upstream.check())
+        return nullptr;
+    auto json_response = this->upstream.request(json, UPSTREAM_TIMEOUT_MS);
+    auto response = std::make_shared<Response>();
+    response->json.assign(json_response);
+    this->upstream.idle();
+    if (json_response.empty() || !response_id_span(response->json, response->id_begin, response->id_end))
+        return nullptr;
+    return response;
+}
+
+/*
+ * Forwards a lights read, unless the same read is in flight (then its response is shared) or was
+ * answered within the cache TTL.
+ */
+spiceapi::Proxy::ResponsePtr spiceapi::Proxy::forward_cached(const std::string &key, std::string_view json) {
+    std::unique_lock<std::mutex> lock(this->cache_mutex);
+    auto &entry = this->cache[key];
+    if (entry.response.valid()) {
+
+        // coalesce with the read in flight
+        if (entry.response.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            auto response = entry.response;
+            lock.unlock();
+            this->coalesced++;
+            return response.get();
+        }
+
+        // still fresh
+        if (entry.valid && std::chrono::steady_clock::now() - entry.fetched < this->cache_ttl) {
+            this->cache_hits++;
+            return entry.response.get();
+        }
+    }
+
+    // we fetch it, everyone else waits on us
+    std::promise<ResponsePtr> promise;
+    entry.response = promise.get_future().share();
+    entry.valid = false;
+    lock.unlock();
+
+    // waiters must always get an answer, a failure is passed on as no response
+    ResponsePtr response;
+    try {
+        response = this->forward(json);
+    } catch (...) {
+        response = nullptr;
+    }
+
+    // only finished entries get evicted, so the reference is still good while ours is in flight
+    lock.lock();
+    auto now = std::chrono::steady_clock::now();
+    entry.fetched = now;
+    entry.valid = response != nullptr;
+    promise.set_value(response);
+    if (this->cache.size() > CACHE_ENTRIES_MAX)
+        this->cache_evict(now);
+    return response;
+}
+
+/*
+ * Drops every finished entry which isn't fresh anymore, or all finished ones if that's not enough. Entries
+ * in flight stay, since their fetcher still holds on to them. Must be called with the cache mutex held.
+ */
+void spiceapi::Proxy::cache_evict(std::chrono::steady_clock::time_point now) {
+    for (int pass = 0; pass < 2 && this->cache.size() > CACHE_ENTRIES_MAX; pass++) {
+        for (auto it = this->cache.begin(); it != this->cache.end();) {
+            auto &entry = it->second;
+            bool finished = !entry.response.valid()
+                    || entry.response.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            bool fresh = entry.valid && now - entry.fetched < this->cache_ttl;
+            if (finished && (pass > 0 || !fresh))
+                it = this->cache.erase(it);
+            else
+                it++;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef SPICEAPI_PROXY_H
+#define SPICEAPI_PROXY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "connection.h"
+
+namespace spiceapi {
+
+    /*
+     * Local SpiceAPI-compatible endpoint which multiplexes other tools (stream overlays, loggers, ...) over
+     * one upstream connection, so they don't each need their own connection to the game.
+     *
+     * Every client gets its own session thread and RC4 state, and speaks the same protocol as it would to
+     * spice2x. Requests are forwarded upstream one at a time with a fresh ID, and the response goes back
+     * with the client's ID patched in. Lights reads (lights read and ddr tapeled_get) are the big payloads
+     * everyone polls, so they're handled specially:
+     *
+     *   - identical reads which arrive while one is already in flight wait for its response instead of
+     *     being forwarded again
+     *   - a response is reused for the cache TTL (one 30Hz frame by default), so any number of clients
+     *     polling at the frame rate cost the game one poll per frame
+     *
+     * Failed upstream requests are answered with an error and never cached. Finished entries are evicted
+     * once there are more than CACHE_ENTRIES_MAX of them, so clients which vary their params can't grow
+     * the cache without bound.
+     */
+    class Proxy {
+    private:
+        static constexpr int CACHE_TTL_MS_DEFAULT = 33;
+        static constexpr int UPSTREAM_TIMEOUT_MS = 100;
+        static constexpr int POLL_INTERVAL_MS = 100;
+        static constexpr size_t CACHE_ENTRIES_MAX = 64;
+
+        // an upstream response, with where its ID sits so it can be swapped for the client's
+        struct Response {
+            std::string json;
+            size_t id_begin = 0;
+            size_t id_end = 0;
+        };
+        typedef std::shared_ptr<const Response> ResponsePtr;
+
+        struct CacheEntry {
+            std::shared_future<ResponsePtr> response;
+            std::chrono::steady_clock::time_point fetched;
+            bool valid = false;
+        };
+
+        struct Client {
+            socket_t socket = SOCKET_INVALID;
+            std::thread thread;
+            std::atomic<bool> done{false};
+        };
+
+        Connection &upstream;
+        std::string password;
+        std::chrono::milliseconds cache_ttl{CACHE_TTL_MS_DEFAULT};
+
+        std::atomic<bool> running{false};
+        socket_t listener = SOCKET_INVALID;
+        std::thread listener_thread;
+        std::mutex clients_mutex;
+        std::vector<std::unique_ptr<Client>> clients;
+
+        std::mutex upstream_mutex;
+        std::mutex cache_mutex;
+        std::unordered_map<std::string, CacheEntry> cache;
+
+        // statistics
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> forwarded{0};
+        std::atomic<uint64_t> cache_hits{0};
+        std::atomic<uint64_t> coalesced{0};
+        std::atomic<uint64_t> errors{0};
+
+        void accept_loop();
+        void serve(Client *client);
+        void handle(const char *json, std::string &out);
+        ResponsePtr forward(std::string_view json);
+        ResponsePtr forward_cached(const std::string &key, std::string_view json);
+        void cache_evict(std::chrono::steady_clock::time_point now);
+
+    public:
+        Proxy(Connection &upstream, std::string password = "");
+        ~Proxy();
+
+        // listens on the loopback interface only, other tools are expected to run on the same machine
+        bool start(uint16_t port);
+        void stop();
+
+        // how long lights responses are reused, 0 to only coalesce reads which are in flight
+        void set_cache_ttl(int ttl_ms);
+
+        uint64_t get_accepted() const {
+            return this->accepted;
+        }
+        uint64_t get_requests() const {
+            return this->requests;
+        }
+        uint64_t get_forwarded() const {
+            return this->forwarded;
+        }
+        uint64_t get_cache_hits() const {
+            return this->cache_hits;
+        }
+        uint64_t get_coalesced() const {
+            return this->coalesced;
+        }
+        uint64_t get_errors() const {
+            return this->errors;
+        }
+    };
+}
+
+#endif //SPICEAPI_PROXY_H
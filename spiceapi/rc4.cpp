@@ -1,6 +1,38 @@
 #include "rc4.h"
+#include <cstring>
 #include <iterator>
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SPICEAPI_RC4_SSE2
+#endif
+
+namespace spiceapi {
+
+    /*
+     * XORs the keystream into the data, 16 bytes at a time where possible.
+     */
+    static void xor_bytes(uint8_t *data, const uint8_t *key, size_t size) {
+        size_t pos = 0;
+#ifdef SPICEAPI_RC4_SSE2
+        for (; pos + 16 <= size; pos += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *) (data + pos));
+            __m128i stream = _mm_loadu_si128((const __m128i *) (key + pos));
+            _mm_storeu_si128((__m128i *) (data + pos), _mm_xor_si128(block, stream));
+        }
+#endif
+        for (; pos + 8 <= size; pos += 8) {
+            uint64_t block, stream;
+            memcpy(&block, data + pos, 8);
+            memcpy(&stream, key + pos, 8);
+            block ^= stream;
+            memcpy(data + pos, &block, 8);
+        }
+        for (; pos < size; pos++)
+            data[pos] ^= key[pos];
+    }
+}
+
 spiceapi::RC4::RC4(uint8_t *key, size_t key_size) {
 
     // initialize S-BOX
@@ -8,38 +40,82 @@ spiceapi::RC4::RC4(uint8_t *key, size_t key_size) {
         s_box[i] = (uint8_t) i;
 
     // check key size
-    if (!key_size)
-        return;
+    if (key_size) {
+
+        // KSA
+        size_t j = 0;
+        for (size_t i = 0; i < std::size(s_box); i++) {
+
+            // update
+            j = (j + s_box[i] + key[i % key_size]) % std::size(s_box);
+
+            // swap
+            auto tmp = s_box[i];
+            s_box[i] = s_box[j];
+            s_box[j] = tmp;
+        }
+    }
+
+    // the cipher is created while connecting, so the first requests don't have to wait
+    this->refill();
+}
 
-    // KSA
-    size_t j = 0;
-    for (size_t i = 0; i < std::size(s_box); i++) {
+/*
+ * PRGA, writes the next `size` keystream bytes. The indices wrap around by being 8-bit.
+ */
+void spiceapi::RC4::generate(uint8_t *out, size_t size) {
+    uint8_t i = this->a, j = this->b;
+    for (size_t pos = 0; pos < size; pos++) {
 
         // update
-        j = (j + s_box[i] + key[i % key_size]) % std::size(s_box);
+        i++;
+        j += s_box[i];
 
         // swap
         auto tmp = s_box[i];
         s_box[i] = s_box[j];
         s_box[j] = tmp;
+
+        // output
+        out[pos] = s_box[(uint8_t) (s_box[i] + s_box[j])];
     }
+    this->a = i;
+    this->b = j;
 }
 
-void spiceapi::RC4::crypt(uint8_t *data, size_t size) {
+void spiceapi::RC4::refill() {
 
-    // iterate all bytes
-    for (size_t pos = 0; pos < size; pos++) {
+    // move what's left to the front
+    auto remaining = this->keystream_end - this->keystream_pos;
+    if (remaining == KEYSTREAM_SIZE)
+        return;
+    if (remaining > 0 && this->keystream_pos > 0)
+        memmove(this->keystream, this->keystream + this->keystream_pos, remaining);
+    this->keystream_pos = 0;
+    this->keystream_end = remaining;
 
-        // update
-        a = (a + 1) % std::size(s_box);
-        b = (b + s_box[a]) % std::size(s_box);
+    // generate the rest
+    this->generate(this->keystream + remaining, KEYSTREAM_SIZE - remaining);
+    this->keystream_end = KEYSTREAM_SIZE;
+}
 
-        // swap
-        auto tmp = s_box[a];
-        s_box[a] = s_box[b];
-        s_box[b] = tmp;
+void spiceapi::RC4::crypt(uint8_t *data, size_t size) {
+    while (size > 0) {
+
+        // generate on demand if we ran out, only as much as needed
+        if (this->keystream_pos == this->keystream_end) {
+            this->keystream_pos = 0;
+            this->keystream_end = size < KEYSTREAM_SIZE ? size : KEYSTREAM_SIZE;
+            this->generate(this->keystream, this->keystream_end);
+        }
 
-        // crypt
-        data[pos] ^= s_box[(s_box[a] + s_box[b]) % std::size(s_box)];
+        // crypt with the buffered keystream
+        auto count = this->keystream_end - this->keystream_pos;
+        if (count > size)
+            count = size;
+        xor_bytes(data, this->keystream + this->keystream_pos, count);
+        this->keystream_pos += count;
+        data += count;
+        size -= count;
     }
 }
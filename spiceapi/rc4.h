@@ -1,20 +1,38 @@
 #ifndef SPICEAPI_RC4_H
 #define SPICEAPI_RC4_H
 
+#include <cstddef>
 #include <cstdint>
 
 namespace spiceapi {
 
+    /*
+     * RC4 with the keystream generated ahead of time. The byte-by-byte generator only runs from refill(),
+     * which callers do between requests, so crypting a message is just a vector XOR against the buffer.
+     * If the buffer runs dry, more keystream is generated on the spot, so the output is always the same
+     * as plain RC4.
+     */
     class RC4 {
     private:
+        static constexpr size_t KEYSTREAM_SIZE = 4096;
+
         uint8_t s_box[256];
-        size_t a = 0, b = 0;
+        uint8_t a = 0, b = 0;
+
+        uint8_t keystream[KEYSTREAM_SIZE];
+        size_t keystream_pos = 0;
+        size_t keystream_end = 0;
+
+        void generate(uint8_t *out, size_t size);
 
     public:
 
         RC4(uint8_t *key, size_t key_size);
 
         void crypt(uint8_t *data, size_t size);
+
+        // tops up the keystream buffer, call when not in a hurry
+        void refill();
     };
 }
 
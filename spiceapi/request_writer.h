@@ -0,0 +1,81 @@
+#ifndef SPICEAPI_REQUEST_WRITER_H
+#define SPICEAPI_REQUEST_WRITER_H
+
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include "wrappers.h"
+#include "../rapidjson/stringbuffer.h"
+#include "../rapidjson/writer.h"
+
+namespace spiceapi {
+
+    /*
+     * Serializes requests straight from typed arguments into a reusable buffer, with no document in
+     * between. Params are written by type: bools, integers, floats and strings as JSON values, and
+     * callables taking the writer for anything nested, like the [name, value] pairs most writes use.
+     * The buffer only grows, so once it's warmed up building a request doesn't allocate.
+     *
+     * Requests are returned as views into the buffer, valid until the next build on the same writer.
+     */
+    class RequestWriter {
+    private:
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer;
+        uint64_t id = 0;
+
+    public:
+        RequestWriter() : writer(buffer) {
+        }
+
+        uint64_t get_id() const {
+            return this->id;
+        }
+
+        template<typename T>
+        void value(const T &param) {
+            if constexpr (std::is_same_v<T, bool>)
+                this->writer.Bool(param);
+            else if constexpr (std::is_floating_point_v<T>)
+                this->writer.Double(param);
+            else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+                this->writer.Int64(param);
+            else if constexpr (std::is_integral_v<T>)
+                this->writer.Uint64(param);
+            else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+                std::string_view str(param);
+                this->writer.String(str.data(), (rapidjson::SizeType) str.length());
+            } else
+                param(*this);
+        }
+
+        template<typename... Values>
+        void array(const Values &... values) {
+            this->writer.StartArray();
+            (this->value(values), ...);
+            this->writer.EndArray();
+        }
+
+        template<typename... Params>
+        std::string_view build(const char *module, const char *function, const Params &... params) {
+            this->buffer.Clear();
+            this->writer.Reset(this->buffer);
+            this->id = msg_gen_id();
+
+            // header, then the params array
+            this->writer.StartObject();
+            this->writer.Key("id", 2);
+            this->writer.Uint64(this->id);
+            this->writer.Key("module", 6);
+            this->writer.String(module);
+            this->writer.Key("function", 8);
+            this->writer.String(function);
+            this->writer.Key("params", 6);
+            this->array(params...);
+            this->writer.EndObject();
+            return std::string_view(this->buffer.GetString(), this->buffer.GetSize());
+        }
+    };
+}
+
+#endif //SPICEAPI_REQUEST_WRITER_H
@@ -0,0 +1,204 @@
+#include "socket.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+bool spiceapi::socket_startup() {
+#ifdef _WIN32
+    WSADATA wsa_data;
+    return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+#else
+    return true;
+#endif
+}
+
+void spiceapi::socket_cleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+int spiceapi::socket_error() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+bool spiceapi::socket_would_block(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EWOULDBLOCK || error == EAGAIN;
+#endif
+}
+
+bool spiceapi::socket_in_progress(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+    return error == EINPROGRESS;
+#endif
+}
+
+spiceapi::socket_t spiceapi::socket_open(int family, int type, int protocol) {
+    return ::socket(family, type, protocol);
+}
+
+void spiceapi::socket_close(socket_t sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    ::close(sock);
+#endif
+}
+
+bool spiceapi::socket_connect(socket_t sock, const sockaddr *addr, size_t addr_len, int timeout_ms) {
+
+    // start connecting without blocking
+    if (!socket_set_nonblocking(sock, true))
+        return false;
+    bool connected = connect(sock, addr, (int) addr_len) == 0;
+    if (!connected && socket_in_progress(socket_error())) {
+
+        // wait for the result
+        if (socket_poll(sock, SOCKET_POLL_WRITE, timeout_ms) > 0) {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            connected = getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*) &error, &error_len) == 0 && error == 0;
+        }
+    }
+
+    // back to blocking for the request path
+    return socket_set_nonblocking(sock, false) && connected;
+}
+
+bool spiceapi::socket_set_nodelay(socket_t sock, bool enabled) {
+    int opt_val = enabled ? 1 : 0;
+    return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*) &opt_val, sizeof(opt_val)) == 0;
+}
+
+bool spiceapi::socket_set_nonblocking(socket_t sock, bool enabled) {
+#ifdef _WIN32
+    u_long mode = enabled ? 1 : 0;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0)
+        return false;
+    flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(sock, F_SETFL, flags) == 0;
+#endif
+}
+
+namespace spiceapi {
+
+    static bool socket_set_timeout(socket_t sock, int option, int timeout_ms) {
+#ifdef _WIN32
+        DWORD opt_val = (DWORD) timeout_ms;
+        return setsockopt(sock, SOL_SOCKET, option, (const char*) &opt_val, sizeof(opt_val)) == 0;
+#else
+        timeval opt_val;
+        opt_val.tv_sec = timeout_ms / 1000;
+        opt_val.tv_usec = (timeout_ms % 1000) * 1000;
+        return setsockopt(sock, SOL_SOCKET, option, &opt_val, sizeof(opt_val)) == 0;
+#endif
+    }
+}
+
+bool spiceapi::socket_set_receive_timeout(socket_t sock, int timeout_ms) {
+    return socket_set_timeout(sock, SO_RCVTIMEO, timeout_ms);
+}
+
+bool spiceapi::socket_set_send_timeout(socket_t sock, int timeout_ms) {
+    return socket_set_timeout(sock, SO_SNDTIMEO, timeout_ms);
+}
+
+bool spiceapi::socket_set_keepalive(socket_t sock, int idle_ms, int interval_ms) {
+#ifdef _WIN32
+    tcp_keepalive alive{};
+    alive.onoff = 1;
+    alive.keepalivetime = (ULONG) idle_ms;
+    alive.keepaliveinterval = (ULONG) interval_ms;
+    DWORD bytes_returned = 0;
+    return WSAIoctl(sock, SIO_KEEPALIVE_VALS, &alive, sizeof(alive), NULL, 0, &bytes_returned, NULL, NULL) == 0;
+#else
+    int opt_val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &opt_val, sizeof(opt_val)) != 0)
+        return false;
+#ifdef TCP_KEEPIDLE
+    int idle_s = (idle_ms + 999) / 1000;
+    int interval_s = (interval_ms + 999) / 1000;
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle_s, sizeof(idle_s));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval_s, sizeof(interval_s));
+#endif
+    return true;
+#endif
+}
+
+int spiceapi::socket_send(socket_t sock, const void *data, size_t size) {
+#ifdef _WIN32
+    int result = send(sock, (const char*) data, (int) size, 0);
+    return result == SOCKET_ERROR ? -1 : result;
+#else
+    ssize_t result;
+    do {
+        result = send(sock, data, size, MSG_NOSIGNAL);
+    } while (result < 0 && errno == EINTR);
+    return (int) result;
+#endif
+}
+
+int spiceapi::socket_receive(socket_t sock, void *data, size_t size) {
+#ifdef _WIN32
+    int result = recv(sock, (char*) data, (int) size, 0);
+    return result == SOCKET_ERROR ? -1 : result;
+#else
+    ssize_t result;
+    do {
+        result = recv(sock, data, size, 0);
+    } while (result < 0 && errno == EINTR);
+    return (int) result;
+#endif
+}
+
+int spiceapi::socket_poll(socket_t sock, int events, int timeout_ms) {
+#ifdef _WIN32
+    WSAPOLLFD fd = {};
+    fd.fd = sock;
+    fd.events = (events & SOCKET_POLL_READ ? POLLRDNORM : 0) | (events & SOCKET_POLL_WRITE ? POLLWRNORM : 0);
+    int result = WSAPoll(&fd, 1, timeout_ms);
+    if (result == SOCKET_ERROR)
+        return -1;
+#else
+    pollfd fd = {};
+    fd.fd = sock;
+    fd.events = (events & SOCKET_POLL_READ ? POLLIN : 0) | (events & SOCKET_POLL_WRITE ? POLLOUT : 0);
+    int result;
+    do {
+        result = poll(&fd, 1, timeout_ms);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0)
+        return -1;
+#endif
+    if (result == 0)
+        return 0;
+
+    // translate back, errors and hangups wake up readers
+    int ready = 0;
+    if (fd.revents & (POLLIN | POLLERR | POLLHUP))
+        ready |= SOCKET_POLL_READ;
+    if (fd.revents & POLLOUT)
+        ready |= SOCKET_POLL_WRITE;
+    if ((fd.revents & (POLLERR | POLLHUP)) && (events & SOCKET_POLL_WRITE))
+        ready |= SOCKET_POLL_WRITE;
+    return ready & events;
+}
@@ -0,0 +1,79 @@
+#ifndef SPICEAPI_SOCKET_H
+#define SPICEAPI_SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#include <mstcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#endif
+
+namespace spiceapi {
+
+    /*
+     * Thin layer over the platform socket API, so the rest of the module builds on both Windows (Winsock)
+     * and POSIX systems. Everything here works on plain socket handles, errors are reported through
+     * socket_error() like errno/WSAGetLastError.
+     */
+#ifdef _WIN32
+    typedef SOCKET socket_t;
+    static const socket_t SOCKET_INVALID = INVALID_SOCKET;
+#else
+    typedef int socket_t;
+    static const socket_t SOCKET_INVALID = -1;
+#endif
+
+    // readiness flags for socket_poll
+    static const int SOCKET_POLL_READ = 1;
+    static const int SOCKET_POLL_WRITE = 2;
+
+    bool socket_startup();
+    void socket_cleanup();
+    int socket_error();
+    bool socket_would_block(int error);
+    bool socket_in_progress(int error);
+
+    socket_t socket_open(int family, int type, int protocol);
+    void socket_close(socket_t sock);
+
+    /*
+     * Connects with a timeout, by connecting in non-blocking mode and waiting for the socket to become
+     * writable. The socket is left in blocking mode either way.
+     */
+    bool socket_connect(socket_t sock, const sockaddr *addr, size_t addr_len, int timeout_ms);
+
+    bool socket_set_nodelay(socket_t sock, bool enabled);
+    bool socket_set_nonblocking(socket_t sock, bool enabled);
+    bool socket_set_receive_timeout(socket_t sock, int timeout_ms);
+    bool socket_set_send_timeout(socket_t sock, int timeout_ms);
+
+    /*
+     * Enables TCP keepalive, probing after `idle_ms` without traffic and then every `interval_ms`, so a
+     * peer which vanished without closing the connection is noticed by the OS.
+     */
+    bool socket_set_keepalive(socket_t sock, int idle_ms, int interval_ms);
+
+    /*
+     * Returns the number of bytes transferred, 0 if the peer closed the connection (receive only), or -1
+     * on error. Non-blocking sockets which aren't ready fail with an error socket_would_block() accepts.
+     */
+    int socket_send(socket_t sock, const void *data, size_t size);
+    int socket_receive(socket_t sock, void *data, size_t size);
+
+    /*
+     * Waits until the socket is ready for the given SOCKET_POLL_* events, for at most `timeout_ms`
+     * (-1 waits forever). Returns the ready events, 0 on timeout, or -1 on error. Hangups and socket
+     * errors are reported as readable, so the following receive picks them up.
+     */
+    int socket_poll(socket_t sock, int events, int timeout_ms);
+}
+
+#endif //SPICEAPI_SOCKET_H
@@ -1,6 +1,10 @@
 #include "wrappers.h"
+#include "request_writer.h"
+#include <atomic>
 #include <random>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 /*
  * RapidJSON dependency
@@ -13,102 +17,655 @@ using namespace rapidjson;
 
 namespace spiceapi {
 
-    static inline std::string doc2str(Document &doc) {
-        StringBuffer sb;
-        rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
-        doc.Accept(writer);
-        return sb.GetString();
+    // one writer per thread, since every connection is owned by a single thread
+    static inline RequestWriter &request_writer() {
+        static thread_local RequestWriter writer;
+        return writer;
     }
 
-    static inline Document request_gen(const char *module, const char *function) {
+    static inline ResponseDocument *response_get(Connection &con, std::string_view json) {
 
-        // create document
-        Document doc;
-        doc.SetObject();
-
-        // add attributes
-        auto &alloc = doc.GetAllocator();
-        doc.AddMember("id", msg_gen_id(), alloc);
-        doc.AddMember("module", StringRef(module), alloc);
-        doc.AddMember("function", StringRef(function), alloc);
-
-        // add params
-        Value noparam(kArrayType);
-        doc.AddMember("params", noparam, alloc);
-
-        // return document
-        return doc;
-    }
-
-    static inline Document *response_get(std::string json) {
-
-        // parse document
-        Document *doc = new Document();
-        doc->Parse(json.c_str());
-
-        // check for parse error
-        if (doc->HasParseError()) {
-            delete doc;
+        // parse document in place, using the connection's arena
+        ResponseDocument *doc = con.response_parse(json);
+        if (!doc)
             return nullptr;
-        }
 
         // check id
         auto it_id = doc->FindMember("id");
-        if (it_id == doc->MemberEnd() || !(*it_id).value.IsUint64()) {
-            delete doc;
+        if (it_id == doc->MemberEnd() || !(*it_id).value.IsUint64())
             return nullptr;
-        }
 
         // check errors
         auto it_errors = doc->FindMember("errors");
-        if (it_errors == doc->MemberEnd() || !(*it_errors).value.IsArray()) {
-            delete doc;
+        if (it_errors == doc->MemberEnd() || !(*it_errors).value.IsArray())
             return nullptr;
-        }
 
         // check error count
-        if ((*it_errors).value.Size() > 0) {
-            delete doc;
+        if ((*it_errors).value.Size() > 0)
             return nullptr;
-        }
 
         // check data
         auto it_data = doc->FindMember("data");
-        if (it_data == doc->MemberEnd() || !(*it_data).value.IsArray()) {
-            delete doc;
+        if (it_data == doc->MemberEnd() || !(*it_data).value.IsArray())
             return nullptr;
-        }
 
         // return document
         return doc;
     }
+
+    /*
+     * SAX handler which only picks up the top level message ID, and stops the parse as soon as it
+     * has it. Used to match pipelined responses to their requests without parsing them twice.
+     */
+    struct ResponseIdHandler : public BaseReaderHandler<UTF8<>, ResponseIdHandler> {
+        int depth = 0;
+        bool is_id_key = false;
+        bool has_id = false;
+        uint64_t id = 0;
+
+        bool Default() {
+            return !has_id;
+        }
+        bool Uint(unsigned value) {
+            return Uint64(value);
+        }
+        bool Uint64(uint64_t value) {
+            if (depth == 1 && is_id_key) {
+                id = value;
+                has_id = true;
+            }
+            return !has_id;
+        }
+        bool Key(const char *str, SizeType length, bool) {
+            is_id_key = depth == 1 && length == 2 && memcmp(str, "id", 2) == 0;
+            return true;
+        }
+        bool StartObject() {
+            depth++;
+            return true;
+        }
+        bool EndObject(SizeType) {
+            depth--;
+            return true;
+        }
+        bool StartArray() {
+            depth++;
+            return true;
+        }
+        bool EndArray(SizeType) {
+            depth--;
+            return true;
+        }
+    };
+
+    static inline bool response_id(Connection &con, std::string_view json, uint64_t &id) {
+        ResponseIdHandler handler;
+        con.response_scan(json, handler);
+        id = handler.id;
+        return handler.has_id;
+    }
+
+    /*
+     * Sends a single request and decodes its response, recording the endpoint's metrics on the way.
+     * `start` is when building the request began, so the serialize time covers it.
+     */
+    template<typename Decode>
+    static inline bool request_measured(Connection &con, Endpoint endpoint, uint64_t start,
+            std::string_view json, Decode decode) {
+        auto &metrics = con.get_metrics()[endpoint];
+        auto sent = metrics_now();
+        metrics.serialize.record(sent - start);
+        metrics.requests++;
+        metrics.bytes_out += json.length() + 1;
+
+        // round trip
+        auto response = con.request(json);
+        auto received = metrics_now();
+        if (response.empty()) {
+
+            // still decoded, so outputs get reset like for any other failure
+            metrics.errors++;
+            return decode(response);
+        }
+        metrics.round_trip.record(received - sent);
+        metrics.bytes_in += response.length() + 1;
+
+        // decode
+        bool result = decode(response);
+        metrics.parse.record(metrics_now() - received);
+        if (!result)
+            metrics.errors++;
+        return result;
+    }
+
+    static inline std::string_view buttons_write_req(RequestWriter &writer, const ButtonValue *states, size_t count) {
+        return writer.build("buttons", "write", [states, count](RequestWriter &writer) {
+            for (size_t i = 0; i < count; i++)
+                writer.array(BUTTON_NAMES.name(states[i].id), states[i].value);
+        });
+    }
+
+    static inline std::string_view card_insert_req(RequestWriter &writer, size_t index, const char *card_id) {
+        return writer.build("card", "insert", index, card_id);
+    }
+
+    /*
+     * Base SAX handler for responses, which does the same id/errors/data validation as response_get
+     * and forwards everything inside "data" to the derived handler's data_* hooks. Depths passed to
+     * the hooks are absolute, the data array itself is depth 2.
+     */
+    template<typename Derived>
+    class ResponseHandler : public BaseReaderHandler<UTF8<>, Derived> {
+    private:
+        enum Section { SECTION_NONE, SECTION_ID, SECTION_ERRORS, SECTION_DATA };
+
+        Section section = SECTION_NONE;
+        int depth = 0;
+
+        Derived &derived() {
+            return *static_cast<Derived *>(this);
+        }
+
+        bool number(double value, bool is_uint) {
+            if (section == SECTION_ID && depth == 1 && is_uint)
+                has_id = true;
+            else if (section == SECTION_ERRORS && depth >= 2)
+                has_errors = true;
+            else if (section == SECTION_DATA && depth >= 2)
+                derived().data_number(depth, value);
+            return true;
+        }
+
+        bool start(bool is_array) {
+            if (section == SECTION_ERRORS && depth >= 2)
+                has_errors = true;
+            if (section == SECTION_DATA && depth == 1 && is_array)
+                has_data = true;
+            depth++;
+            if (section == SECTION_DATA && depth >= 3)
+                derived().data_start(depth);
+            return true;
+        }
+
+        bool end() {
+            if (section == SECTION_DATA && depth >= 3)
+                derived().data_end(depth);
+            depth--;
+            return true;
+        }
+
+    protected:
+        void data_key(int, std::string_view) {
+        }
+        void data_string(int, std::string_view) {
+        }
+        void data_number(int, double) {
+        }
+        void data_start(int) {
+        }
+        void data_end(int) {
+        }
+
+    public:
+        bool has_id = false;
+        bool has_errors = false;
+        bool has_data = false;
+
+        bool valid() const {
+            return has_id && !has_errors && has_data;
+        }
+
+        bool Default() {
+            if (section == SECTION_ERRORS && depth >= 2)
+                has_errors = true;
+            return true;
+        }
+        bool Int(int value) {
+            return number(value, false);
+        }
+        bool Uint(unsigned value) {
+            return number(value, true);
+        }
+        bool Int64(int64_t value) {
+            return number((double) value, false);
+        }
+        bool Uint64(uint64_t value) {
+            return number((double) value, true);
+        }
+        bool Double(double value) {
+            return number(value, false);
+        }
+        bool String(const char *str, SizeType length, bool) {
+            if (section == SECTION_ERRORS && depth >= 2)
+                has_errors = true;
+            else if (section == SECTION_DATA && depth >= 2)
+                derived().data_string(depth, std::string_view(str, length));
+            return true;
+        }
+        bool Key(const char *str, SizeType length, bool) {
+            std::string_view key(str, length);
+            if (depth == 1) {
+                section = key == "id" ? SECTION_ID
+                        : key == "errors" ? SECTION_ERRORS
+                        : key == "data" ? SECTION_DATA
+                        : SECTION_NONE;
+            } else if (section == SECTION_DATA && depth >= 3) {
+                derived().data_key(depth, key);
+            }
+            return true;
+        }
+        bool StartObject() {
+            return start(false);
+        }
+        bool EndObject(SizeType) {
+            return end();
+        }
+        bool StartArray() {
+            return start(true);
+        }
+        bool EndArray(SizeType) {
+            return end();
+        }
+    };
+
+    /*
+     * Decodes a ddr tapeled_get response straight into a TapeLedFrame, without building a document.
+     * Device names are looked up through the perfect hash table, unknown devices are skipped.
+     */
+    class TapeLedHandler : public ResponseHandler<TapeLedHandler> {
+    private:
+        TapeLedFrame &frame;
+        size_t data_objects = 0;
+        uint8_t *device_values = nullptr;
+        size_t device_capacity = 0;
+        size_t *device_size = nullptr;
+
+        template<size_t LedCount>
+        void select_device(TapeLedDevice<LedCount> &device) {
+            device_values = device.values.data();
+            device_capacity = device.values.size();
+            device_size = &device.size;
+            *device_size = 0;
+        }
+
+    public:
+        explicit TapeLedHandler(TapeLedFrame &frame) : frame(frame) {
+        }
+
+        void data_start(int depth) {
+            if (depth == 3)
+                data_objects++;
+        }
+        void data_end(int depth) {
+            if (depth == 4)
+                device_values = nullptr;
+        }
+        void data_key(int depth, std::string_view key) {
+            if (depth != 3 || data_objects != 1)
+                return;
+            device_values = nullptr;
+            int id = TAPELED_NAMES.find(key);
+            if (id < 0)
+                return;
+            if (id <= TAPELED_P2_FOOT_DOWN)
+                select_device(frame.foot[id / 4][id % 4]);
+            else if (id == TAPELED_TOP_PANEL)
+                select_device(frame.top_panel);
+            else if (id == TAPELED_MONITOR_LEFT)
+                select_device(frame.monitor_left);
+            else if (id == TAPELED_MONITOR_RIGHT)
+                select_device(frame.monitor_right);
+        }
+        void data_number(int depth, double value) {
+            if (depth != 4 || device_values == nullptr)
+                return;
+            if (*device_size < device_capacity)
+                device_values[*device_size] = (uint8_t) value;
+            (*device_size)++;
+        }
+    };
+
+    /*
+     * Decodes a lights read response straight into a LightFrame. Each entry is a [name, value] pair,
+     * names which aren't part of the gold cabinet profile are skipped.
+     */
+    class LightsHandler : public ResponseHandler<LightsHandler> {
+    private:
+        LightFrame &frame;
+        int light = -1;
+
+    public:
+        explicit LightsHandler(LightFrame &frame) : frame(frame) {
+        }
+
+        void data_start(int depth) {
+            if (depth == 3)
+                light = -1;
+        }
+        void data_string(int depth, std::string_view name) {
+            if (depth == 3)
+                light = LIGHT_NAMES.find(name);
+        }
+        void data_number(int depth, double value) {
+            if (depth == 3 && light >= 0)
+                frame.values[light] = (float) value;
+        }
+    };
+
+    /*
+     * Only validates a response, for requests which don't return any data we care about.
+     */
+    class StatusHandler : public ResponseHandler<StatusHandler> {
+    };
+
+    static inline bool status_res(Connection &con, std::string_view json) {
+        StatusHandler handler;
+        return con.response_parse(json, handler) && handler.valid();
+    }
+
+    static inline bool ddr_tapeled_get_res(Connection &con, std::string_view json, TapeLedFrame &frame) {
+
+        // reset frame, devices missing from the response stay empty
+        frame.valid = false;
+        for (auto &player : frame.foot)
+            for (auto &device : player)
+                device.size = 0;
+        frame.top_panel.size = 0;
+        frame.monitor_left.size = 0;
+        frame.monitor_right.size = 0;
+
+        // decode
+        TapeLedHandler handler(frame);
+        if (!con.response_parse(json, handler) || !handler.valid())
+            return false;
+
+        frame.valid = true;
+        return true;
+    }
+
+    static inline bool lights_read_res(Connection &con, std::string_view json, LightFrame &frame) {
+
+        // reset frame, lights missing from the response read as off
+        frame.valid = false;
+        frame.values.fill(0.f);
+
+        // decode
+        LightsHandler handler(frame);
+        if (!con.response_parse(json, handler) || !handler.valid())
+            return false;
+
+        frame.valid = true;
+        return true;
+    }
+
+    static inline std::string_view keypads_set_req(RequestWriter &writer, unsigned int keypad, std::vector<char> &keys) {
+        return writer.build("keypads", "set", keypad, [&keys](RequestWriter &writer) {
+            for (auto &key : keys)
+                writer.value(std::string_view(&key, 1));
+        });
+    }
 }
 
-uint64_t spiceapi::msg_gen_id() {
-    static uint64_t id_global = 0;
+spiceapi::Pipeline::Pipeline(spiceapi::Connection &con) : con(con) {
+}
 
-    // check if global ID was initialized
-    if (id_global == 0) {
+void spiceapi::Pipeline::add(uint64_t id, std::string_view request, Endpoint endpoint, uint64_t start,
+        std::function<bool(std::string_view)> handler) {
+
+    // entries are kept between batches, so their request strings keep their capacity
+    if (this->entry_count == this->entries.size())
+        this->entries.emplace_back();
+    auto &entry = this->entries[this->entry_count++];
+    entry.id = id;
+    entry.endpoint = endpoint;
+    entry.request.assign(request);
+    entry.handler = std::move(handler);
+    entry.complete = nullptr;
+    entry.done = false;
+    this->con.get_metrics()[endpoint].serialize.record(metrics_now() - start);
+}
 
-        // generate a new ID
-        std::random_device rd;
-        std::mt19937_64 gen(rd());
-        std::uniform_int_distribution<uint64_t> dist(1, (uint64_t) std::llround(std::pow(2, 63)));
-        id_global = dist(gen);
+void spiceapi::Pipeline::buttons_write(const ButtonValue *states, size_t count) {
+    auto start = metrics_now();
+    auto &writer = request_writer();
+    auto json = buttons_write_req(writer, states, count);
+    this->add(writer.get_id(), json, ENDPOINT_BUTTONS_WRITE, start, [this](std::string_view json) {
+        return status_res(this->con, json);
+    });
+}
 
-    } else {
+void spiceapi::Pipeline::card_insert(size_t index, const char *card_id) {
+    auto start = metrics_now();
+    auto &writer = request_writer();
+    auto json = card_insert_req(writer, index, card_id);
+    this->add(writer.get_id(), json, ENDPOINT_CARD_INSERT, start, [this](std::string_view json) {
+        return response_get(this->con, json) != nullptr;
+    });
+}
+
+void spiceapi::Pipeline::ddr_tapeled_get(TapeLedFrame &frame) {
+    auto start = metrics_now();
+    auto &writer = request_writer();
+    auto json = writer.build("ddr", "tapeled_get");
+    this->add(writer.get_id(), json, ENDPOINT_DDR_TAPELED_GET, start, [this, &frame](std::string_view json) {
+        return ddr_tapeled_get_res(this->con, json, frame);
+    });
+}
+
+void spiceapi::Pipeline::keypads_set(unsigned int keypad, std::vector<char> &keys) {
+    auto start = metrics_now();
+    auto &writer = request_writer();
+    auto json = keypads_set_req(writer, keypad, keys);
+    this->add(writer.get_id(), json, ENDPOINT_KEYPADS_SET, start, [this](std::string_view json) {
+        return response_get(this->con, json) != nullptr;
+    });
+}
+
+void spiceapi::Pipeline::lights_read(LightFrame &frame) {
+    auto start = metrics_now();
+    auto &writer = request_writer();
+    auto json = writer.build("lights", "read");
+    this->add(writer.get_id(), json, ENDPOINT_LIGHTS_READ, start, [this, &frame](std::string_view json) {
+        return lights_read_res(this->con, json, frame);
+    });
+}
+
+void spiceapi::Pipeline::on_complete(std::function<void(bool)> complete) {
+    if (this->entry_count > 0)
+        this->entries[this->entry_count - 1].complete = std::move(complete);
+}
+
+size_t spiceapi::Pipeline::execute() {
+
+    // send as many batches as the connection's limits need, each is answered before the next goes out
+    size_t succeeded = 0;
+    this->response_count = 0;
+    size_t first = 0;
+    while (first < this->entry_count) {
+        size_t last = first;
+        size_t batch_bytes = 0;
+        while (last < this->entry_count && last - first < Connection::PIPELINE_REQUESTS_MAX) {
+            size_t bytes = this->entries[last].request.length() + 1;
+            if (last > first && batch_bytes + bytes > Connection::PIPELINE_BYTES_MAX)
+                break;
+            batch_bytes += bytes;
+            last++;
+        }
+        succeeded += this->execute_batch(first, last);
+        first = last;
+    }
+
+    // requests which didn't get a response failed
+    auto &metrics = this->con.get_metrics();
+    for (size_t i = 0; i < this->entry_count; i++) {
+        auto &entry = this->entries[i];
+        if (!entry.done) {
+            metrics[entry.endpoint].errors++;
+            if (entry.complete)
+                entry.complete(false);
+        }
 
-        // increase by one
-        id_global++;
+        // don't keep whatever the callbacks captured alive until the entry is reused
+        entry.handler = nullptr;
+        entry.complete = nullptr;
     }
 
-    // return global ID
-    return id_global;
+    // pipeline can be reused for a new batch
+    this->entry_count = 0;
+    return succeeded;
+}
+
+size_t spiceapi::Pipeline::execute_batch(size_t first, size_t last) {
+
+    // send all requests at once
+    this->requests.clear();
+    auto &metrics = this->con.get_metrics();
+    for (size_t i = first; i < last; i++) {
+        auto &entry = this->entries[i];
+        this->requests.push_back(entry.request);
+        metrics[entry.endpoint].requests++;
+        metrics[entry.endpoint].bytes_out += entry.request.length() + 1;
+    }
+    auto sent = metrics_now();
+    this->con.request_pipelined(this->requests, this->responses);
+    auto received = metrics_now();
+    this->response_count += this->responses.size();
+
+    // dispatch responses to their requests by id
+    size_t succeeded = 0;
+    for (auto &json : this->responses) {
+        uint64_t id;
+        if (!response_id(this->con, json, id))
+            continue;
+        for (size_t i = first; i < last; i++) {
+            auto &entry = this->entries[i];
+            if (entry.id == id && !entry.done) {
+                auto &endpoint = metrics[entry.endpoint];
+                endpoint.round_trip.record(received - sent);
+                endpoint.bytes_in += json.length() + 1;
+                auto parse_start = metrics_now();
+                entry.done = true;
+                bool result = entry.handler(json);
+                endpoint.parse.record(metrics_now() - parse_start);
+                if (result)
+                    succeeded++;
+                else
+                    endpoint.errors++;
+                if (entry.complete)
+                    entry.complete(result);
+                break;
+            }
+        }
+    }
+    return succeeded;
+}
+
+spiceapi::ButtonsWriteRequest::ButtonsWriteRequest() {
+    std::array<ButtonId, BUTTON_COUNT> buttons;
+    for (size_t i = 0; i < buttons.size(); i++)
+        buttons[i] = (ButtonId) i;
+    *this = ButtonsWriteRequest(buttons.data(), buttons.size());
+}
+
+spiceapi::ButtonsWriteRequest::ButtonsWriteRequest(const ButtonId *buttons, size_t count) {
+    this->value_offsets.fill(VALUE_NONE);
+    this->built_values.fill('0');
+
+    // header, with the ID field left blank
+    this->json = "{\"id\":";
+    this->id_offset = this->json.length();
+    this->json.append(ID_FIELD_LENGTH, ' ');
+    this->json += ",\"module\":\"buttons\",\"function\":\"write\",\"params\":[";
+    this->params_offset = this->json.length();
+
+    // one [name, value] pair per button, remembering where each entry and value digit lives
+    for (size_t i = 0; i < count; i++) {
+        if (this->has(buttons[i]))
+            continue;
+        if (this->json.back() != '[')
+            this->json += ',';
+        this->entry_offsets[buttons[i]] = this->json.length();
+        this->json += "[\"";
+        this->json += BUTTON_NAMES.name(buttons[i]);
+        this->json += "\",";
+        this->value_offsets[buttons[i]] = this->json.length();
+        this->json += "0.0]";
+        this->entry_lengths[buttons[i]] = this->json.length() - this->entry_offsets[buttons[i]];
+    }
+    this->json += "]}";
+
+    // a changes request can hold at most every entry
+    this->changes.reserve(this->json.length());
+}
+
+void spiceapi::ButtonsWriteRequest::patch_id(uint64_t id) {
+
+    // write the ID right aligned, the remaining leading bytes are whitespace
+    char *field = &this->json[this->id_offset];
+    size_t pos = ID_FIELD_LENGTH;
+    do {
+        field[--pos] = (char) ('0' + id % 10);
+        id /= 10;
+    } while (id > 0 && pos > 0);
+    while (pos > 0)
+        field[--pos] = ' ';
+}
+
+bool spiceapi::ButtonsWriteRequest::changed() const {
+    for (size_t button = 0; button < BUTTON_COUNT; button++) {
+        auto offset = this->value_offsets[button];
+        if (offset != VALUE_NONE && this->json[offset] != this->built_values[button])
+            return true;
+    }
+    return false;
+}
+
+std::string_view spiceapi::ButtonsWriteRequest::build(uint64_t id) {
+    this->patch_id(id);
+    for (size_t button = 0; button < BUTTON_COUNT; button++) {
+        if (this->value_offsets[button] != VALUE_NONE)
+            this->built_values[button] = this->json[this->value_offsets[button]];
+    }
+    return this->json;
+}
+
+std::string_view spiceapi::ButtonsWriteRequest::build_changes(uint64_t id) {
+
+    // header including the ID, then only the entries which changed
+    this->patch_id(id);
+    this->changes.assign(this->json, 0, this->params_offset);
+    for (size_t button = 0; button < BUTTON_COUNT; button++) {
+        auto offset = this->value_offsets[button];
+        if (offset == VALUE_NONE || this->json[offset] == this->built_values[button])
+            continue;
+        if (this->changes.back() != '[')
+            this->changes += ',';
+        this->changes.append(this->json, this->entry_offsets[button], this->entry_lengths[button]);
+        this->built_values[button] = this->json[offset];
+    }
+    this->changes += "]}";
+    return this->changes;
+}
+
+uint64_t spiceapi::msg_gen_id() {
+
+    /*
+     * Called from every worker thread at once, so the ID is seeded once (function-local statics are
+     * initialized thread safe) and then handed out atomically, which keeps every ID unique.
+     */
+    static std::atomic<uint64_t> id_global([]() {
+        std::random_device rd;
+        std::mt19937_64 gen(rd());
+        std::uniform_int_distribution<uint64_t> dist(1, (uint64_t) std::llround(std::pow(2, 63)));
+        return dist(gen);
+    }());
+
+    // return global ID and increase by one
+    return id_global.fetch_add(1, std::memory_order_relaxed);
 }
 
 bool spiceapi::analogs_read(spiceapi::Connection &con, std::vector<spiceapi::AnalogState> &states) {
-    auto req = request_gen("analogs", "read");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("analogs", "read")));
     if (!res)
         return false;
     auto &data = (*res)["data"];
@@ -118,48 +675,31 @@ bool spiceapi::analogs_read(spiceapi::Connection &con, std::vector<spiceapi::Ana
         state.value = val[1].GetFloat();
         states.push_back(state);
     }
-    delete res;
     return true;
 }
 
 bool spiceapi::analogs_write(spiceapi::Connection &con, std::vector<spiceapi::AnalogState> &states) {
-    auto req = request_gen("analogs", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        state_val.PushBack(state.value, alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("analogs", "write", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name, state.value);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::analogs_write_reset(spiceapi::Connection &con, std::vector<spiceapi::AnalogState> &states) {
-    auto req = request_gen("analogs", "write_reset");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("analogs", "write_reset", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::buttons_read(spiceapi::Connection &con, std::vector<spiceapi::ButtonState> &states) {
-    auto req = request_gen("buttons", "read");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("buttons", "read")));
     if (!res)
         return false;
     auto &data = (*res)["data"];
@@ -169,203 +709,197 @@ bool spiceapi::buttons_read(spiceapi::Connection &con, std::vector<spiceapi::But
         state.value = val[1].GetFloat();
         states.push_back(state);
     }
-    delete res;
     return true;
 }
 
 bool spiceapi::buttons_write(spiceapi::Connection &con, std::vector<spiceapi::ButtonState> &states) {
-    auto req = request_gen("buttons", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        state_val.PushBack(state.value, alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("buttons", "write", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name, state.value);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
+bool spiceapi::buttons_write(spiceapi::Connection &con, const spiceapi::ButtonValue *states, size_t count) {
+    auto start = metrics_now();
+    auto json = buttons_write_req(request_writer(), states, count);
+    return request_measured(con, ENDPOINT_BUTTONS_WRITE, start, json, [&con](std::string_view json) {
+        return status_res(con, json);
+    });
+}
+
+bool spiceapi::buttons_write(spiceapi::Connection &con, spiceapi::ButtonsWriteRequest &request) {
+    auto start = metrics_now();
+    auto json = request.build(msg_gen_id());
+    return request_measured(con, ENDPOINT_BUTTONS_WRITE, start, json, [&con](std::string_view json) {
+        return status_res(con, json);
+    });
+}
+
+bool spiceapi::buttons_write_changes(spiceapi::Connection &con, spiceapi::ButtonsWriteRequest &request) {
+    auto start = metrics_now();
+    auto json = request.build_changes(msg_gen_id());
+    return request_measured(con, ENDPOINT_BUTTONS_WRITE, start, json, [&con](std::string_view json) {
+        return status_res(con, json);
+    });
+}
+
 bool spiceapi::buttons_write_reset(spiceapi::Connection &con, std::vector<spiceapi::ButtonState> &states) {
-    auto req = request_gen("buttons", "write_reset");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("buttons", "write_reset", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::card_insert(spiceapi::Connection &con, size_t index, const char *card_id) {
-    auto req = request_gen("card", "insert");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(index, alloc);
-    params.PushBack(StringRef(card_id), alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
-    if (!res)
-        return false;
-    delete res;
-    return true;
+    auto start = metrics_now();
+    auto json = card_insert_req(request_writer(), index, card_id);
+    return request_measured(con, ENDPOINT_CARD_INSERT, start, json, [&con](std::string_view json) {
+        return response_get(con, json) != nullptr;
+    });
 }
 
 bool spiceapi::coin_get(Connection &con, int &coins) {
-    auto req = request_gen("coin", "get");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("coin", "get")));
     if (!res)
         return false;
     coins = (*res)["data"][0].GetInt();
-    delete res;
     return true;
 }
 
+spiceapi::LinkState spiceapi::health_probe(Connection &con, const HealthProbeConfig &config) {
+    auto &health = con.get_metrics().health;
+    health.probes++;
+
+    // round trip
+    bool ok = false;
+    uint64_t rtt = 0;
+    if (con.check()) {
+        auto json = request_writer().build("coin", "get");
+        auto sent = metrics_now();
+        auto response = con.request(json, config.timeout_ms);
+        rtt = metrics_now() - sent;
+        ok = !response.empty() && response_get(con, response);
+    }
+
+    // update state
+    LinkState state;
+    if (ok) {
+        health.consecutive_failures = 0;
+        health.rtt.record(rtt);
+        health.last_rtt_ns = rtt;
+        state = rtt > config.degraded_rtt_us * 1000 ? LINK_DEGRADED : LINK_HEALTHY;
+        if (state == LINK_DEGRADED)
+            health.degraded++;
+    } else {
+        health.failures++;
+        health.consecutive_failures++;
+        state = health.consecutive_failures >= config.dead_failures ? LINK_DEAD : LINK_DEGRADED;
+
+        // drop the socket once when the link dies, it stays dead until a probe gets through again
+        if (health.consecutive_failures == config.dead_failures) {
+            health.dead++;
+            con.disconnect();
+        }
+    }
+    health.state = state;
+    return state;
+}
+
 bool spiceapi::coin_set(Connection &con, int coins) {
-    auto req = request_gen("coin", "set");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(coins, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("coin", "set", coins)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::coin_insert(Connection &con, int coins) {
-    auto req = request_gen("coin", "insert");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(coins, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("coin", "insert", coins)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::coin_blocker_get(Connection &con, bool &closed) {
-    auto req = request_gen("coin", "blocker_get");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("coin", "blocker_get")));
     if (!res)
         return false;
     closed = (*res)["data"][0].GetBool();
-    delete res;
     return true;
 }
 
 bool spiceapi::control_raise(spiceapi::Connection &con, const char *signal) {
-    auto req = request_gen("control", "raise");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(StringRef(signal), alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "raise", signal)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::control_exit(spiceapi::Connection &con) {
-    auto req = request_gen("control", "exit");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "exit")));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::control_exit(spiceapi::Connection &con, int exit_code) {
-    auto req = request_gen("control", "exit");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(exit_code, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "exit", exit_code)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::control_restart(spiceapi::Connection &con) {
-    auto req = request_gen("control", "restart");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "restart")));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::control_session_refresh(spiceapi::Connection &con) {
-    auto req = request_gen("control", "session_refresh");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "session_refresh")));
     if (!res)
         return false;
     auto key = (*res)["data"][0].GetString();
     con.change_pass(key);
-    delete res;
     return true;
 }
 
 bool spiceapi::control_shutdown(spiceapi::Connection &con) {
-    auto req = request_gen("control", "shutdown");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "shutdown")));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::control_reboot(spiceapi::Connection &con) {
-    auto req = request_gen("control", "reboot");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("control", "reboot")));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::iidx_ticker_set(spiceapi::Connection &con, const char *ticker) {
-    auto req = request_gen("iidx", "ticker_set");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(StringRef(ticker), alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("iidx", "ticker_set", ticker)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::iidx_ticker_reset(spiceapi::Connection &con) {
-    auto req = request_gen("iidx", "ticker_reset");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("iidx", "ticker_reset")));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::info_avs(spiceapi::Connection &con, spiceapi::InfoAvs &info) {
-    auto req = request_gen("info", "avs");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("info", "avs")));
     if (!res)
         return false;
     auto &data = (*res)["data"][0];
@@ -374,13 +908,11 @@ bool spiceapi::info_avs(spiceapi::Connection &con, spiceapi::InfoAvs &info) {
     info.spec = data["spec"].GetString();
     info.rev = data["rev"].GetString();
     info.ext = data["ext"].GetString();
-    delete res;
     return true;
 }
 
 bool spiceapi::info_launcher(spiceapi::Connection &con, spiceapi::InfoLauncher &info) {
-    auto req = request_gen("info", "launcher");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("info", "launcher")));
     if (!res)
         return false;
     auto &data = (*res)["data"][0];
@@ -390,13 +922,11 @@ bool spiceapi::info_launcher(spiceapi::Connection &con, spiceapi::InfoLauncher &
     info.system_time = data["system_time"].GetString();
     for (auto &arg : data["args"].GetArray())
         info.args.push_back(arg.GetString());
-    delete res;
     return true;
 }
 
 bool spiceapi::info_memory(spiceapi::Connection &con, spiceapi::InfoMemory &info) {
-    auto req = request_gen("info", "memory");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("info", "memory")));
     if (!res)
         return false;
     auto &data = (*res)["data"][0];
@@ -406,195 +936,108 @@ bool spiceapi::info_memory(spiceapi::Connection &con, spiceapi::InfoMemory &info
     info.vmem_total = data["vmem_total"].GetUint64();
     info.vmem_total_used = data["vmem_total_used"].GetUint64();
     info.vmem_used = data["vmem_used"].GetUint64();
-    delete res;
     return true;
 }
 
 bool spiceapi::keypads_write(spiceapi::Connection &con, unsigned int keypad, const char *input) {
-    auto req = request_gen("keypads", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(keypad, alloc);
-    params.PushBack(StringRef(input), alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("keypads", "write", keypad, input)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::keypads_set(spiceapi::Connection &con, unsigned int keypad, std::vector<char> &keys) {
-    auto req = request_gen("keypads", "set");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(keypad, alloc);
-    for (auto &key : keys)
-        params.PushBack(StringRef(&key, 1), alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
-    if (!res)
-        return false;
-    delete res;
-    return true;
+    auto start = metrics_now();
+    auto json = keypads_set_req(request_writer(), keypad, keys);
+    return request_measured(con, ENDPOINT_KEYPADS_SET, start, json, [&con](std::string_view json) {
+        return response_get(con, json) != nullptr;
+    });
 }
 
 bool spiceapi::keypads_get(spiceapi::Connection &con, unsigned int keypad, std::vector<char> &keys) {
-    auto req = request_gen("keypads", "get");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(keypad, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("keypads", "get", keypad)));
     if (!res)
         return false;
     auto &data = (*res)["data"];
     for (auto &val : data.GetArray())
         keys.push_back(val.GetString()[0]);
-    delete res;
     return true;
 }
 
 bool spiceapi::lights_read(Connection& con, std::map<std::string, float>& states) {
-    auto req = request_gen("lights", "read");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("lights", "read")));
     if (!res)
         return false;
     auto &data = (*res)["data"];
     for (auto &val : data.GetArray()) {
         states[val[0].GetString()] = val[1].GetFloat();
     }
-    delete res;
-    return true;
-}
-
-bool spiceapi::ddr_tapeled_get(Connection& con, std::map<std::string, std::vector<uint8_t>>& states) {
-    static const char* device_names[11] = {
-            "p1_foot_up",
-            "p1_foot_right",
-            "p1_foot_left",
-            "p1_foot_down",
-            "p2_foot_up",
-            "p2_foot_right",
-            "p2_foot_left",
-            "p2_foot_down",
-            "top_panel",
-            "monitor_left",
-            "monitor_right"
-    };
-
-    auto req = request_gen("ddr", "tapeled_get");
-    auto res = response_get(con.request(doc2str(req)));
-
-    if (!res)
-        return false;
-
-    auto& data = (*res)["data"].GetArray()[0];
-
-    for (size_t device = 0; device < 11; device++) {
-        std::string name = std::string(device_names[device]);
-        std::vector<uint8_t> values;
-
-        for (auto& arg : data[name.c_str()].GetArray()) {
-            values.push_back(arg.GetUint());
-        }
+    return true;
+}
 
-        states[name] = values;
-    }
+bool spiceapi::lights_read(Connection& con, LightFrame& frame) {
+    auto start = metrics_now();
+    auto json = request_writer().build("lights", "read");
+    return request_measured(con, ENDPOINT_LIGHTS_READ, start, json, [&con, &frame](std::string_view json) {
+        return lights_read_res(con, json, frame);
+    });
+}
 
-    delete res;
-    return true;
+bool spiceapi::ddr_tapeled_get(Connection& con, TapeLedFrame& frame) {
+    auto start = metrics_now();
+    auto json = request_writer().build("ddr", "tapeled_get");
+    return request_measured(con, ENDPOINT_DDR_TAPELED_GET, start, json, [&con, &frame](std::string_view json) {
+        return ddr_tapeled_get_res(con, json, frame);
+    });
 }
 
 bool spiceapi::lights_write(spiceapi::Connection &con, std::vector<spiceapi::LightState> &states) {
-    auto req = request_gen("lights", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        state_val.PushBack(state.value, alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("lights", "write", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name, state.value);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::lights_write_reset(spiceapi::Connection &con, std::vector<spiceapi::LightState> &states) {
-    auto req = request_gen("lights", "write_reset");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(StringRef(state.name.c_str()), alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("lights", "write_reset", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.name);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::memory_write(spiceapi::Connection &con, const char *dll_name, const char *hex, uint32_t offset) {
-    auto req = request_gen("memory", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(StringRef(dll_name), alloc);
-    params.PushBack(StringRef(hex), alloc);
-    params.PushBack(offset, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("memory", "write", dll_name, hex, offset)));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::memory_read(spiceapi::Connection &con, const char *dll_name, uint32_t offset, uint32_t size,
         std::string &hex) {
-    auto req = request_gen("memory", "read");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(StringRef(dll_name), alloc);
-    params.PushBack(offset, alloc);
-    params.PushBack(size, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("memory", "read", dll_name, offset, size)));
     if (!res)
         return false;
     hex = (*res)["data"][0].GetString();
-    delete res;
     return true;
 }
 
 bool spiceapi::memory_signature(spiceapi::Connection &con, const char *dll_name, const char *signature,
                                 const char *replacement, uint32_t offset, uint32_t usage, uint32_t &file_offset) {
-    auto req = request_gen("memory", "signature");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    params.PushBack(StringRef(dll_name), alloc);
-    params.PushBack(StringRef(signature), alloc);
-    params.PushBack(StringRef(replacement), alloc);
-    params.PushBack(offset, alloc);
-    params.PushBack(usage, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("memory", "signature", dll_name, signature, replacement, offset, usage)));
     if (!res)
         return false;
     file_offset = (*res)["data"][0].GetUint();
-    delete res;
     return true;
 }
 
 bool spiceapi::touch_read(spiceapi::Connection &con, std::vector<spiceapi::TouchState> &states) {
-    auto req = request_gen("touch", "read");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("touch", "read")));
     if (!res)
         return false;
     auto &data = (*res)["data"];
@@ -605,46 +1048,31 @@ bool spiceapi::touch_read(spiceapi::Connection &con, std::vector<spiceapi::Touch
         state.y = val[2].GetInt64();
         states.push_back(state);
     }
-    delete res;
     return true;
 }
 
 bool spiceapi::touch_write(spiceapi::Connection &con, std::vector<spiceapi::TouchState> &states) {
-    auto req = request_gen("touch", "write");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states) {
-        Value state_val(kArrayType);
-        state_val.PushBack(state.id, alloc);
-        state_val.PushBack(state.x, alloc);
-        state_val.PushBack(state.y, alloc);
-        params.PushBack(state_val, alloc);
-    }
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("touch", "write", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.array(state.id, state.x, state.y);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::touch_write_reset(spiceapi::Connection &con, std::vector<spiceapi::TouchState> &states) {
-    auto req = request_gen("touch", "write_reset");
-    auto &alloc = req.GetAllocator();
-    Value params(kArrayType);
-    for (auto &state : states)
-        params.PushBack(state.id, alloc);
-    req["params"] = params;
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("touch", "write_reset", [&states](RequestWriter &writer) {
+        for (auto &state : states)
+            writer.value(state.id);
+    })));
     if (!res)
         return false;
-    delete res;
     return true;
 }
 
 bool spiceapi::lcd_info(spiceapi::Connection &con, spiceapi::LCDInfo &info) {
-    auto req = request_gen("lcd", "info");
-    auto res = response_get(con.request(doc2str(req)));
+    auto res = response_get(con, con.request(request_writer().build("lcd", "info")));
     if (!res)
         return false;
     auto &data = (*res)["data"][0];
@@ -656,6 +1084,5 @@ bool spiceapi::lcd_info(spiceapi::Connection &con, spiceapi::LCDInfo &info) {
     info.red = data["red"].GetInt();
     info.green = data["green"].GetInt();
     info.blue = data["blue"].GetInt();
-    delete res;
     return true;
 }
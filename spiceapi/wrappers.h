@@ -1,10 +1,15 @@
 #ifndef SPICEAPI_WRAPPERS_H
 #define SPICEAPI_WRAPPERS_H
 
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <map>
 #include <string>
+#include <string_view>
+#include <functional>
 #include "connection.h"
+#include "names.h"
 
 namespace spiceapi {
 
@@ -18,16 +23,60 @@ namespace spiceapi {
         float value;
     };
 
+    struct ButtonValue {
+        ButtonId id;
+        float value;
+    };
+
     struct LightState {
         std::string name;
         float value;
     };
 
+    // values for every light in the gold cabinet profile, indexed by LightId
+    struct LightFrame {
+        bool valid;
+        std::array<float, LIGHT_COUNT> values;
+    };
+
     struct TapeLedLightState {
         std::string name;
         std::vector<uint8_t> values;
     };
 
+    // LED counts for the DDR gold cabinet tape LED devices
+    static const size_t TAPELED_FOOT_LED_COUNT = 25;
+    static const size_t TAPELED_TOP_PANEL_LED_COUNT = 40;
+    static const size_t TAPELED_MONITOR_LED_COUNT = 25;
+
+    // indices of the foot panel devices for each player in TapeLedFrame::foot
+    enum TapeLedFoot {
+        TAPELED_FOOT_UP = 0,
+        TAPELED_FOOT_RIGHT = 1,
+        TAPELED_FOOT_LEFT = 2,
+        TAPELED_FOOT_DOWN = 3
+    };
+
+    // RGB values for a single tape LED device, `size` is how many values were received
+    template<size_t LedCount>
+    struct TapeLedDevice {
+        std::array<uint8_t, LedCount * 3> values;
+        size_t size;
+
+        bool complete() const {
+            return size >= values.size();
+        }
+    };
+
+    // fixed layout for a full ddr tapeled_get response, which is decoded into in place
+    struct TapeLedFrame {
+        bool valid;
+        TapeLedDevice<TAPELED_FOOT_LED_COUNT> foot[2][4];
+        TapeLedDevice<TAPELED_TOP_PANEL_LED_COUNT> top_panel;
+        TapeLedDevice<TAPELED_MONITOR_LED_COUNT> monitor_left;
+        TapeLedDevice<TAPELED_MONITOR_LED_COUNT> monitor_right;
+    };
+
     struct InfoAvs {
         std::string model, dest, spec, rev, ext;
     };
@@ -56,12 +105,117 @@ namespace spiceapi {
 
     uint64_t msg_gen_id();
 
+    /*
+     * Collects several requests and sends them to SpiceAPI as one pipelined batch, so they cost a single
+     * round trip instead of one each. Responses are matched back to their requests by message ID. The
+     * outputs passed in are only written once execute() is called, and must stay valid until then.
+     * More requests than the connection takes in one batch are sent as several, one after the other.
+     */
+    class Pipeline {
+    private:
+        struct Entry {
+            uint64_t id;
+            Endpoint endpoint;
+            std::string request;
+            std::function<bool(std::string_view)> handler;
+            std::function<void(bool)> complete;
+            bool done;
+        };
+
+        Connection &con;
+        std::vector<Entry> entries;
+        size_t entry_count = 0;
+        std::vector<std::string_view> requests;
+        std::vector<std::string_view> responses;
+        size_t response_count = 0;
+
+        size_t execute_batch(size_t first, size_t last);
+        void add(uint64_t id, std::string_view request, Endpoint endpoint, uint64_t start,
+                std::function<bool(std::string_view)> handler);
+
+    public:
+        explicit Pipeline(Connection &con);
+
+        void buttons_write(const ButtonValue *states, size_t count);
+        void card_insert(size_t index, const char *card_id);
+        void ddr_tapeled_get(TapeLedFrame &frame);
+        void keypads_set(unsigned int keypad, std::vector<char> &keys);
+        void lights_read(LightFrame &frame);
+
+        /*
+         * Sets a callback for the last added request, which is called from execute() with whether it
+         * succeeded. Requests that never got a response complete with false.
+         */
+        void on_complete(std::function<void(bool)> complete);
+
+        size_t execute();
+
+        // how many responses the last execute() received
+        size_t get_response_count() const {
+            return this->response_count;
+        }
+    };
+
+    /*
+     * Prebuilt buttons write request for a fixed set of buttons. The JSON is serialized once, and each
+     * frame only patches the message ID digits and one byte per button value in place. The ID field is
+     * padded with leading whitespace to fit any ID, and values are sent as 0.0 or 1.0, so buttons set
+     * with a float are treated as pressed from 0.5 up.
+     *
+     * It also remembers which values were last built, so a request with only the changed buttons can
+     * be built by copying their prebuilt entries.
+     */
+    class ButtonsWriteRequest {
+    private:
+        static constexpr size_t ID_FIELD_LENGTH = 20;
+        static constexpr size_t VALUE_NONE = SIZE_MAX;
+
+        std::string json;
+        size_t id_offset;
+        size_t params_offset;
+        std::array<size_t, BUTTON_COUNT> value_offsets;
+        std::array<size_t, BUTTON_COUNT> entry_offsets;
+        std::array<size_t, BUTTON_COUNT> entry_lengths;
+        std::array<char, BUTTON_COUNT> built_values;
+        std::string changes;
+
+        void patch_id(uint64_t id);
+
+    public:
+        // all buttons in the gold cabinet profile
+        ButtonsWriteRequest();
+        ButtonsWriteRequest(const ButtonId *buttons, size_t count);
+
+        bool has(ButtonId button) const {
+            return this->value_offsets[button] != VALUE_NONE;
+        }
+        void set(ButtonId button, bool pressed) {
+            if (this->has(button))
+                this->json[this->value_offsets[button]] = pressed ? '1' : '0';
+        }
+        void set(ButtonId button, float value) {
+            this->set(button, value >= 0.5f);
+        }
+
+        // whether any value differs from the last built request
+        bool changed() const;
+
+        // patches in a new message ID, and returns the request with every button ready to be sent
+        std::string_view build(uint64_t id);
+
+        // returns a request with only the buttons which changed since the last build
+        std::string_view build_changes(uint64_t id);
+    };
+
     bool analogs_read(Connection &con, std::vector<AnalogState> &states);
     bool analogs_write(Connection &con, std::vector<AnalogState> &states);
     bool analogs_write_reset(Connection &con, std::vector<AnalogState> &states);
 
     bool buttons_read(Connection &con, std::vector<ButtonState> &states);
     bool buttons_write(Connection &con, std::vector<ButtonState> &states);
+    bool buttons_write(Connection &con, const ButtonValue *states, size_t count);
+    bool buttons_write(Connection &con, ButtonsWriteRequest &request);
+    bool buttons_write_changes(Connection &con, ButtonsWriteRequest &request);
     bool buttons_write_reset(Connection &con, std::vector<ButtonState> &states);
 
     bool card_insert(Connection &con, size_t index, const char *card_id);
@@ -79,7 +233,7 @@ namespace spiceapi {
     bool control_shutdown(Connection &con);
     bool control_reboot(Connection &con);
 
-    bool ddr_tapeled_get(Connection& con, std::map<std::string, std::vector<uint8_t>>& states);
+    bool ddr_tapeled_get(Connection& con, TapeLedFrame& frame);
 
     bool iidx_ticker_set(Connection &con, const char *ticker);
     bool iidx_ticker_reset(Connection &con);
@@ -93,6 +247,7 @@ namespace spiceapi {
     bool keypads_get(Connection &con, unsigned int keypad, std::vector<char> &keys);
 
     bool lights_read(Connection &con, std::map<std::string, float>& states);
+    bool lights_read(Connection &con, LightFrame& frame);
     bool lights_write(Connection &con, std::vector<LightState> &states);
     bool lights_write_reset(Connection &con, std::vector<LightState> &states);
 
@@ -106,6 +261,20 @@ namespace spiceapi {
     bool touch_write_reset(Connection &con, std::vector<TouchState> &states);
 
     bool lcd_info(Connection &con, LCDInfo &info);
+
+    /*
+     * Health probing. A probe is a cheap request (coin get) with its own short timeout, which measures the
+     * round trip and updates the connection's LinkHealth. A link is degraded while probes are slower than
+     * degraded_rtt_us, and dead after dead_failures probes in a row failed, at which point it's dropped so
+     * the next check() reconnects instead of waiting on a half-open socket.
+     */
+    struct HealthProbeConfig {
+        int timeout_ms = 250;
+        uint64_t degraded_rtt_us = 10000;
+        uint32_t dead_failures = 3;
+    };
+
+    LinkState health_probe(Connection &con, const HealthProbeConfig &config = HealthProbeConfig());
 }
 
 #endif //SPICEAPI_WRAPPERS_H
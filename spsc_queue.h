@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/*
+    Bounded lock-free queue for exactly one producer thread and one consumer thread. Pushing and popping
+    never block or allocate, so it's safe to push from callbacks on threads we don't own. Each side
+    keeps a cached copy of the other side's index, so it only touches the shared cache line when the
+    queue looks full (producer) or empty (consumer).
+*/
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    // Producer only. Returns false without blocking if the queue is full.
+    bool TryPush(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - head_cache_ == Capacity) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+
+            if (tail - head_cache_ == Capacity) {
+                return false;
+            }
+        }
+
+        slots_[tail & (Capacity - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool TryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+
+        item = slots_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Consumer side, on its own cache line so the two threads don't keep stealing it from each other
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    size_t tail_cache_ = 0;
+    // Producer side
+    alignas(64) std::atomic<size_t> tail_{ 0 };
+    size_t head_cache_ = 0;
+
+    alignas(64) std::array<T, Capacity> slots_{};
+};
@@ -0,0 +1,93 @@
+/*
+ * Allocation counting for the tools under tools/, by replacing the allocator for the whole program. Include
+ * it from exactly one source file of a tool, since it defines the replacement functions.
+ *
+ * With glibc every malloc is counted, operator new and rapidjson's allocations included. Elsewhere only
+ * operator new is replaced, so allocations made straight through malloc aren't seen.
+ */
+#ifndef TOOLS_ALLOC_COUNTER_H
+#define TOOLS_ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+
+    inline std::atomic<bool> enabled{false};
+    inline std::atomic<uint64_t> allocations{0};
+
+    inline void record() {
+        if (enabled.load(std::memory_order_relaxed))
+            allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // runs `op` and returns how many allocations were made meanwhile, on any thread
+    template<typename Op>
+    uint64_t counted(Op &&op) {
+        uint64_t before = allocations;
+        enabled = true;
+        op();
+        enabled = false;
+        return allocations - before;
+    }
+}
+
+#if defined(__GLIBC__)
+
+// everything ends up in malloc, operator new included, so that's where we count
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    void *malloc(size_t size) {
+        alloc_counter::record();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) {
+        alloc_counter::record();
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size) {
+        alloc_counter::record();
+        return __libc_realloc(ptr, size);
+    }
+}
+
+#else
+
+void *operator new(size_t size) {
+    alloc_counter::record();
+    void *ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+#endif
+
+#endif //TOOLS_ALLOC_COUNTER_H
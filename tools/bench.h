@@ -0,0 +1,52 @@
+/*
+ * Timing loop for the benchmarks under tools/.
+ */
+#ifndef TOOLS_BENCH_H
+#define TOOLS_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace bench {
+
+    // results end up in here, so the compiler can't drop the work being measured
+    inline volatile uint64_t sink = 0;
+
+    /*
+     * Calls `op` in batches for at least `min_ms` and returns the average nanoseconds per call. The batch
+     * size is found first by doubling it until a batch takes a millisecond, which doubles as the warmup.
+     * `op` returns a number which goes into the sink.
+     */
+    template<typename Op>
+    double ns_per_op(Op &&op, int min_ms = 500) {
+        using clock = std::chrono::steady_clock;
+        uint64_t result = 0;
+
+        // find batch size
+        uint64_t batch = 1;
+        for (;;) {
+            auto start = clock::now();
+            for (uint64_t i = 0; i < batch; i++)
+                result += op();
+            if (clock::now() - start >= std::chrono::milliseconds(1))
+                break;
+            batch *= 2;
+        }
+
+        // measure
+        uint64_t count = 0;
+        auto start = clock::now();
+        auto end = start;
+        do {
+            for (uint64_t i = 0; i < batch; i++)
+                result += op();
+            count += batch;
+            end = clock::now();
+        } while (end - start < std::chrono::milliseconds(min_ms));
+
+        sink = sink + result;
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / count;
+    }
+}
+
+#endif //TOOLS_BENCH_H
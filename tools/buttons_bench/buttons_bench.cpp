@@ -0,0 +1,178 @@
+/*
+ * Compares building the 1000Hz buttons write request the way InputUtils used to (a vector of ButtonState,
+ * then a rapidjson Document, then a StringBuffer) against the prebuilt ButtonsWriteRequest, which only
+ * patches the value bytes and the message ID. Both requests are checked to hold the same JSON first.
+ *
+ * Runs offline, only the request building is timed.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "spiceapi/wrappers.h"
+#include "rapidjson/document.h"
+#include "rapidjson/writer.h"
+#include "tools/alloc_counter.h"
+#include "tools/bench.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        int time_ms = 1000;
+    };
+
+    Options options;
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --time <ms>           how long to run each benchmark (default 1000)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--time")
+                options.time_ms = atoi(value.c_str());
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // which buttons are held on a given tick, walking through them so the values keep changing
+    bool pressed(uint64_t tick, size_t button) {
+        return (tick / 4 + button) % 6 == 0;
+    }
+
+    // before: the request built like spiceapi::buttons_write(con, std::vector<ButtonState>&) used to
+    std::string build_dom(uint64_t tick, uint64_t id) {
+
+        // InputUtils::PerformMainInputTasks
+        std::vector<ButtonState> states;
+        for (size_t button = 0; button < BUTTON_COUNT; button++) {
+            ButtonState state;
+            state.name = std::string(BUTTON_NAMES.name(button));
+            state.value = (float) pressed(tick, button);
+            states.push_back(state);
+        }
+
+        // request_gen
+        rapidjson::Document req;
+        req.SetObject();
+        auto &alloc = req.GetAllocator();
+        req.AddMember("id", id, alloc);
+        req.AddMember("module", rapidjson::StringRef("buttons"), alloc);
+        req.AddMember("function", rapidjson::StringRef("write"), alloc);
+        rapidjson::Value noparam(rapidjson::kArrayType);
+        req.AddMember("params", noparam, alloc);
+
+        // buttons_write
+        rapidjson::Value params(rapidjson::kArrayType);
+        for (auto &state : states) {
+            rapidjson::Value state_val(rapidjson::kArrayType);
+            state_val.PushBack(rapidjson::StringRef(state.name.c_str()), alloc);
+            state_val.PushBack(state.value, alloc);
+            params.PushBack(state_val, alloc);
+        }
+        req["params"] = params;
+
+        // doc2str
+        rapidjson::StringBuffer sb;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+        req.Accept(writer);
+        return sb.GetString();
+    }
+
+    // after: patch the values into the prebuilt request
+    std::string_view build_template(ButtonsWriteRequest &request, uint64_t tick, uint64_t id) {
+        for (size_t button = 0; button < BUTTON_COUNT; button++)
+            request.set((ButtonId) button, pressed(tick, button));
+        return request.build(id);
+    }
+
+    // after, with only the buttons which changed since the last build
+    std::string_view build_template_changes(ButtonsWriteRequest &request, uint64_t tick, uint64_t id) {
+        for (size_t button = 0; button < BUTTON_COUNT; button++)
+            request.set((ButtonId) button, pressed(tick, button));
+        return request.build_changes(id);
+    }
+
+    bool same_json(std::string_view a, std::string_view b) {
+        rapidjson::Document doc_a, doc_b;
+        doc_a.Parse(a.data(), a.length());
+        doc_b.Parse(b.data(), b.length());
+        return !doc_a.HasParseError() && !doc_b.HasParseError() && doc_a == doc_b;
+    }
+
+    template<typename Op>
+    double allocations_per_op(Op &&op) {
+        const int count = 1000;
+        auto allocations = alloc_counter::counted([&]() {
+            for (int i = 0; i < count; i++)
+                bench::sink = bench::sink + op();
+        });
+        return (double) allocations / count;
+    }
+
+    void report(const char *name, double ns, double allocations) {
+        printf("%-32s %8.0f ns/request %8.1f allocations/request\n", name, ns, allocations);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    // both have to send the same thing for the comparison to mean anything
+    ButtonsWriteRequest request;
+    for (uint64_t tick = 0; tick < 64; tick++) {
+        std::string dom = build_dom(tick, tick + 1);
+        std::string prebuilt(build_template(request, tick, tick + 1));
+        if (!same_json(dom, prebuilt)) {
+            fprintf(stderr, "requests differ on tick %llu:\n%s\n%s\n",
+                    (unsigned long long) tick, dom.c_str(), prebuilt.c_str());
+            return 1;
+        }
+    }
+    printf("requests match\n");
+
+    uint64_t tick = 0;
+    auto dom = [&]() {
+        tick++;
+        return (uint64_t) build_dom(tick, tick).length();
+    };
+    auto prebuilt = [&]() {
+        tick++;
+        return (uint64_t) build_template(request, tick, tick).length();
+    };
+    auto prebuilt_changes = [&]() {
+        tick++;
+        return (uint64_t) build_template_changes(request, tick, tick).length();
+    };
+    report("vector + Document (before)", bench::ns_per_op(dom, options.time_ms), allocations_per_op(dom));
+    report("prebuilt, every button", bench::ns_per_op(prebuilt, options.time_ms),
+            allocations_per_op(prebuilt));
+    report("prebuilt, changes only", bench::ns_per_op(prebuilt_changes, options.time_ms),
+            allocations_per_op(prebuilt_changes));
+    return 0;
+}
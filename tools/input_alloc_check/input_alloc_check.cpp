@@ -0,0 +1,219 @@
+/*
+ * Checks that the stage input request path never touches the heap once it's warmed up, since it runs at
+ * 1000Hz on a time critical thread.
+ *
+ * It runs the input worker's own ticks (InputFrame, which InputUtils::PerformMainInputTasks calls) against a
+ * SpiceAPI server, usually tools/spiceapi_emu, with every allocation counted (see tools/alloc_counter.h).
+ * Pad transitions are fed in like the SMX SDK's thread does, with a burst now and then which overflows the
+ * transition queue, overlay menu and visibility buttons are pressed and released, and the traffic is
+ * captured. After the warmup ticks, any allocation fails the check with a non-zero exit code.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "input_frame.h"
+#include "spiceapi/capture.h"
+#include "tools/alloc_counter.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        uint16_t port = 1337;
+        std::string password = "spicemaniax";
+        int ticks = 5000;
+        int warmup = 1000;
+        int refresh_ms = 100;
+        std::string capture_path = "input_alloc_check.capture";
+    };
+
+    Options options;
+
+    // how often a burst of transitions overflows the queue, so the worker falls back to the latest state
+    const int OVERFLOW_INTERVAL = 500;
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --host <host>         SpiceAPI host, or unix:<path> (default 127.0.0.1)\n"
+               "  --port <port>         SpiceAPI port (default 1337)\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --ticks <count>       input ticks to check (default 5000)\n"
+               "  --warmup <count>      ticks to run first, which may allocate (default 1000)\n"
+               "  --refresh <ms>        full state refresh interval, 0 to send everything every tick (default 100)\n"
+               "  --capture <file>      capture the traffic into this file, empty for none (default input_alloc_check.capture)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--host")
+                options.host = value;
+            else if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--ticks")
+                options.ticks = atoi(value.c_str());
+            else if (arg == "--warmup")
+                options.warmup = atoi(value.c_str());
+            else if (arg == "--refresh")
+                options.refresh_ms = atoi(value.c_str());
+            else if (arg == "--capture")
+                options.capture_path = value;
+            else
+                return false;
+        }
+        return true;
+    }
+
+    /*
+     * The program's input globals, which the frame reads like in the program.
+     */
+    SnapshotStore<InputSnapshot> snapshot;
+    AtomicBitset<kMaxOverlayButtons> overlay_states;
+    std::vector<OverlayButton> overlay_buttons;
+    bool overlay_visible[2] = { false, false };
+
+    // the menu buttons and the visibility toggle for each player, like the overlay sets them up
+    void add_overlay_buttons() {
+        const ButtonId menu_ids[2][5] = {
+            { BUTTON_P1_MENU_UP, BUTTON_P1_MENU_DOWN, BUTTON_P1_MENU_LEFT, BUTTON_P1_MENU_RIGHT, BUTTON_P1_START },
+            { BUTTON_P2_MENU_UP, BUTTON_P2_MENU_DOWN, BUTTON_P2_MENU_LEFT, BUTTON_P2_MENU_RIGHT, BUTTON_P2_START },
+        };
+        for (int player = 0; player < 2; player++) {
+            for (auto id : menu_ids[player]) {
+                OverlayButton button {};
+                button.type_ = OverlayButtonType::MENU;
+                button.player_ = player;
+                button.input_id_ = id;
+                overlay_buttons.push_back(button);
+            }
+            OverlayButton visibility {};
+            visibility.type_ = OverlayButtonType::VISIBILITY;
+            visibility.player_ = player;
+            overlay_buttons.push_back(visibility);
+        }
+        for (size_t i = 0; i < overlay_buttons.size(); i++)
+            overlay_buttons[i].state_index_ = (int) i;
+    }
+
+    // the panel bits with one arrow pressed, or a corner which isn't mapped to anything
+    uint16_t pad_state(size_t step) {
+        const int panels[] = { UP, DOWN, LEFT, RIGHT, UP_LEFT, CENTER };
+        return (uint16_t) (1 << panels[step % 6]);
+    }
+
+    /*
+     * One input tick. The inputs change first, like the SMX SDK's thread and the UI thread change them, then
+     * the frame sends them like the input worker does.
+     */
+    void tick(Connection &con, InputFrame &frame, int tick_index) {
+
+        // walk the arrows like a player would, each pad a step apart
+        if (tick_index % 8 == 0) {
+            for (int player = 0; player < 2; player++)
+                frame.OnPadState(player, pad_state(tick_index / 8 + player));
+        }
+
+        // now and then, more transitions than the queue takes
+        if (tick_index % OVERFLOW_INTERVAL == OVERFLOW_INTERVAL - 1) {
+            for (size_t i = 0; i < kPadTransitionQueueSize + 16; i++)
+                frame.OnPadState(0, pad_state(i));
+        }
+
+        // press and release the overlay buttons in turn
+        if (tick_index % 16 == 0) {
+            size_t index = (tick_index / 32) % overlay_buttons.size();
+            overlay_states.Set(index, (tick_index / 16) % 2 == 0);
+        }
+
+        frame.Tick(con, options.refresh_ms);
+
+        // like the worker does after every task
+        con.idle();
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    Connection con(options.host, options.port, options.password);
+    if (!con.check()) {
+        fprintf(stderr, "unable to connect to %s:%u\n", options.host.c_str(), options.port);
+        return 2;
+    }
+    CaptureWriter capture(options.capture_path);
+    if (!options.capture_path.empty()) {
+        if (!capture.is_open()) {
+            fprintf(stderr, "unable to open capture file %s\n", options.capture_path.c_str());
+            return 2;
+        }
+        con.set_capture(&capture, 0);
+    }
+    add_overlay_buttons();
+    InputFrame frame(snapshot, overlay_states, overlay_buttons, overlay_visible);
+    auto &requests = con.get_metrics()[ENDPOINT_BUTTONS_WRITE];
+
+    // warm up, which grows the connection's buffers to their working size
+    for (int i = 0; i < options.warmup; i++)
+        tick(con, frame, i);
+    if (requests.errors > 0) {
+        fprintf(stderr, "request failed during warmup\n");
+        return 2;
+    }
+
+    // count every allocation from here on, reconnecting would allocate by design so that's a failure too
+    uint64_t connects = con.get_connects();
+    uint64_t sent = requests.requests;
+    int first_allocating_tick = -1;
+    uint64_t allocations = 0;
+    for (int i = 0; i < options.ticks; i++) {
+        uint64_t tick_allocations = alloc_counter::counted([&]() {
+            tick(con, frame, options.warmup + i);
+        });
+        if (tick_allocations > 0 && first_allocating_tick < 0)
+            first_allocating_tick = i;
+        allocations += tick_allocations;
+    }
+    uint64_t failures = requests.errors;
+
+    printf("ticks: %d, requests: %llu, failed requests: %llu, reconnects: %llu, allocations: %llu\n",
+            options.ticks,
+            (unsigned long long) (requests.requests - sent),
+            (unsigned long long) failures,
+            (unsigned long long) (con.get_connects() - connects),
+            (unsigned long long) allocations);
+    frame.PrintStats();
+    if (failures > 0 || con.get_connects() != connects) {
+        fprintf(stderr, "FAIL: requests failed, so the check isn't meaningful\n");
+        return 2;
+    }
+    if (allocations > 0) {
+        fprintf(stderr, "FAIL: the input path allocated, first on tick %d\n", first_allocating_tick);
+        return 1;
+    }
+    printf("OK: no allocations\n");
+    return 0;
+}
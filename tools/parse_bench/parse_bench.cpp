@@ -0,0 +1,169 @@
+/*
+ * Compares the cost of parsing a ddr tapeled_get response, the largest one we poll for, the way
+ * response_get used to do it (a heap allocated Document parsing a copy of the response) against the
+ * connection's arena with in-place parsing, plus the SAX path the tapeled wrapper uses now.
+ *
+ * The payload is fetched once from a SpiceAPI server, usually tools/spiceapi_emu, so it's a real response.
+ * Parsing is timed without the network.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "spiceapi/connection.h"
+#include "rapidjson/document.h"
+#include "rapidjson/reader.h"
+#include "tools/alloc_counter.h"
+#include "tools/bench.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        uint16_t port = 1337;
+        std::string password = "spicemaniax";
+        int time_ms = 1000;
+    };
+
+    Options options;
+
+    const char TAPELED_GET_REQUEST[] = R"({"id":1,"module":"ddr","function":"tapeled_get","params":[]})";
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --host <host>         SpiceAPI host, or unix:<path> (default 127.0.0.1)\n"
+               "  --port <port>         SpiceAPI port (default 1337)\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --time <ms>           how long to run each benchmark (default 1000)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--host")
+                options.host = value;
+            else if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--time")
+                options.time_ms = atoi(value.c_str());
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // the checks response_get does on every response
+    template<typename Doc>
+    bool response_valid(const Doc &doc) {
+        if (!doc.IsObject())
+            return false;
+        auto it_id = doc.FindMember("id");
+        if (it_id == doc.MemberEnd() || !it_id->value.IsUint64())
+            return false;
+        auto it_errors = doc.FindMember("errors");
+        if (it_errors == doc.MemberEnd() || !it_errors->value.IsArray() || it_errors->value.Size() > 0)
+            return false;
+        auto it_data = doc.FindMember("data");
+        return it_data != doc.MemberEnd() && it_data->value.IsArray();
+    }
+
+    // before: a new Document per response, parsing a copy of it
+    uint64_t parse_heap(const std::string &payload) {
+        std::string json(payload);
+        auto doc = new rapidjson::Document();
+        doc->Parse(json.c_str());
+        bool valid = !doc->HasParseError() && response_valid(*doc);
+        delete doc;
+        return valid ? 1 : 0;
+    }
+
+    /*
+     * In-place parsing overwrites the response, so it's copied back into the receive buffer first. That
+     * costs the same as the copy parse_heap makes.
+     */
+    void restore(std::string_view json, const std::string &payload) {
+        memcpy(const_cast<char *>(json.data()), payload.data(), payload.size());
+    }
+
+    // after: the connection's arena, in place on top of the receive buffer
+    uint64_t parse_arena(Connection &con, std::string_view json, const std::string &payload) {
+        restore(json, payload);
+        auto doc = con.response_parse(json);
+        return doc != nullptr && response_valid(*doc) ? 1 : 0;
+    }
+
+    // after, with SAX: no document at all
+    uint64_t parse_sax(Connection &con, std::string_view json, const std::string &payload) {
+        restore(json, payload);
+        rapidjson::BaseReaderHandler<> handler;
+        return con.response_parse(json, handler) ? 1 : 0;
+    }
+
+    void report(const char *name, double ns, double allocations, size_t size) {
+        printf("%-28s %10.0f ns/parse %8.1f MB/s %8.1f allocations/parse\n",
+                name, ns, size / ns * 1000.0, allocations);
+    }
+
+    template<typename Op>
+    double allocations_per_op(Op &&op) {
+        const int count = 1000;
+        auto allocations = alloc_counter::counted([&]() {
+            for (int i = 0; i < count; i++)
+                bench::sink = bench::sink + op();
+        });
+        return (double) allocations / count;
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    // fetch a real payload
+    Connection con(options.host, options.port, options.password);
+    if (!con.check()) {
+        fprintf(stderr, "unable to connect to %s:%u\n", options.host.c_str(), options.port);
+        return 2;
+    }
+    auto json = con.request(TAPELED_GET_REQUEST);
+    std::string payload(json);
+    if (payload.empty() || parse_heap(payload) == 0) {
+        fprintf(stderr, "no valid tapeled_get response\n");
+        return 2;
+    }
+    printf("payload: %zu bytes\n", payload.size());
+
+    // the view stays valid as long as we don't make another request
+    auto heap = [&]() { return parse_heap(payload); };
+    auto arena = [&]() { return parse_arena(con, json, payload); };
+    auto sax = [&]() { return parse_sax(con, json, payload); };
+    report("Document + Parse (before)", bench::ns_per_op(heap, options.time_ms),
+            allocations_per_op(heap), payload.size());
+    report("arena + ParseInsitu", bench::ns_per_op(arena, options.time_ms),
+            allocations_per_op(arena), payload.size());
+    report("SAX in place", bench::ns_per_op(sax, options.time_ms),
+            allocations_per_op(sax), payload.size());
+    return 0;
+}
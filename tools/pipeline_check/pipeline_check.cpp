@@ -0,0 +1,217 @@
+/*
+ * Checks pipelined requests against a SpiceAPI server, usually tools/spiceapi_emu: that a Pipeline reused
+ * for batch after batch only dispatches the responses of the batch it just sent, like AsyncClient keeps
+ * one for the life of the program.
+ *
+ * With --split-port, it also checks a server which splits a batch across several reads (spiceapi_emu
+ * with --read-max). It answers the first part before reading the rest, which puts the shared RC4 stream
+ * out of step, so the connection has to reset instead of returning garbage.
+ *
+ * Exits non-zero if a check fails.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spiceapi/wrappers.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        uint16_t port = 1337;
+        std::string password = "spicemaniax";
+        int batches = 1000;
+        uint16_t split_port = 0;
+    };
+
+    Options options;
+    int failures = 0;
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --host <host>         SpiceAPI host, or unix:<path> (default 127.0.0.1)\n"
+               "  --port <port>         SpiceAPI port (default 1337)\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --batches <count>     batches to run through one pipeline (default 1000)\n"
+               "  --split-port <port>   port of a server which splits reads, to check for resets (default none)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--host")
+                options.host = value;
+            else if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--batches")
+                options.batches = atoi(value.c_str());
+            else if (arg == "--split-port")
+                options.split_port = (uint16_t) atoi(value.c_str());
+            else
+                return false;
+        }
+        return true;
+    }
+
+    void check(bool condition, const char *name) {
+        printf("%s: %s\n", condition ? "ok" : "FAIL", name);
+        if (!condition)
+            failures++;
+    }
+
+    /*
+     * Two batches of different requests on one pipeline. The second must only see its own response,
+     * not the views left over from the first.
+     */
+    void check_two_batches(Connection &con) {
+        Pipeline pipeline(con);
+        std::vector<char> keys = { '1', '2' };
+        pipeline.keypads_set(0, keys);
+        pipeline.keypads_set(1, keys);
+        pipeline.card_insert(0, "E004010000000000");
+        check(pipeline.execute() == 3, "first batch succeeds");
+        check(pipeline.get_response_count() == 3, "first batch has its 3 responses");
+
+        LightFrame frame;
+        int completions = 0;
+        pipeline.lights_read(frame);
+        pipeline.on_complete([&completions](bool) {
+            completions++;
+        });
+        check(pipeline.execute() == 1, "second batch succeeds");
+        check(completions == 1, "second batch completes once");
+        check(pipeline.get_response_count() == 1, "second batch only dispatches its own response");
+    }
+
+    // a long run on one pipeline, the responses must not pile up
+    void check_many_batches(Connection &con) {
+        Pipeline pipeline(con);
+        LightFrame lights;
+        TapeLedFrame tapeleds;
+        int failed = 0;
+        size_t most_responses = 0;
+        for (int i = 0; i < options.batches; i++) {
+            pipeline.lights_read(lights);
+            pipeline.ddr_tapeled_get(tapeleds);
+            if (pipeline.execute() != 2)
+                failed++;
+            if (pipeline.get_response_count() > most_responses)
+                most_responses = pipeline.get_response_count();
+        }
+        printf("%d batches, %d failed, at most %zu responses kept\n", options.batches, failed, most_responses);
+        check(failed == 0, "every batch succeeds");
+        check(most_responses == 2, "responses don't pile up across batches");
+    }
+
+    // waits out the reconnect backoff
+    bool reconnect(Connection &con) {
+        auto start = std::chrono::steady_clock::now();
+        while (!con.check()) {
+            if (std::chrono::steady_clock::now() - start > std::chrono::seconds(5))
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+    /*
+     * A batch which the server reads in two parts. It must fail with no responses at all, and drop the
+     * connection so the next request starts over with a fresh cipher.
+     */
+    void check_split_batch() {
+        Connection con(options.host, options.split_port, options.password);
+        if (!con.check()) {
+            check(false, "connect to the splitting server");
+            return;
+        }
+        uint64_t connects = con.get_connects();
+
+        // bigger than the server's reads
+        std::string keypad_request = R"({"id":1,"module":"keypads","function":"set","params":[0,"1","2","3"]})";
+        std::string card_request = R"({"id":2,"module":"card","function":"insert","params":[0,"E004010000000000"]})";
+        std::vector<std::string_view> requests = { keypad_request, card_request };
+        std::vector<std::string_view> responses = { "left over" };
+        bool ok = con.request_pipelined(requests, responses);
+        check(!ok, "split batch fails");
+        check(responses.empty(), "split batch returns no responses");
+
+        // reconnected with a fresh cipher, so requests work again
+        check(reconnect(con) && con.get_connects() == connects + 1, "connection is reset");
+        LightFrame frame;
+        check(lights_read(con, frame) && frame.valid, "request after the reset succeeds");
+
+        // and the same through a pipeline
+        Pipeline pipeline(con);
+        std::vector<char> keys = { '1', '2', '3' };
+        pipeline.keypads_set(0, keys);
+        pipeline.card_insert(0, "E004010000000000");
+        check(pipeline.execute() == 0 && pipeline.get_response_count() == 0, "split pipeline gets no responses");
+        check(reconnect(con) && con.get_connects() == connects + 2, "connection is reset again");
+    }
+
+    /*
+     * Batches over the connection's limits are refused, a Pipeline sends them in several parts.
+     */
+    void check_batch_limits(Connection &con) {
+        std::string request = R"({"id":1,"module":"coin","function":"get","params":[]})";
+        std::vector<std::string_view> requests(Connection::PIPELINE_REQUESTS_MAX + 1, request);
+        std::vector<std::string_view> responses;
+        check(!con.request_pipelined(requests, responses) && responses.empty(), "oversized batch is refused");
+
+        Pipeline pipeline(con);
+        std::vector<char> keys = { '1' };
+        size_t count = Connection::PIPELINE_REQUESTS_MAX * 2 + 3;
+        for (size_t i = 0; i < count; i++)
+            pipeline.keypads_set(0, keys);
+        check(pipeline.execute() == count && pipeline.get_response_count() == count,
+                "pipeline splits a large batch");
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    Connection con(options.host, options.port, options.password);
+    if (!con.check()) {
+        fprintf(stderr, "unable to connect to %s:%u\n", options.host.c_str(), options.port);
+        return 2;
+    }
+
+    check_two_batches(con);
+    check_many_batches(con);
+    check_batch_limits(con);
+    if (options.split_port != 0)
+        check_split_batch();
+    if (failures > 0) {
+        fprintf(stderr, "FAIL: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * Compares serializing SpiceAPI requests the way the wrappers used to (a rapidjson Document per request,
+ * params added through its allocator, then walked again by doc2str) against the RequestWriter they use
+ * now, which writes straight from the typed arguments into a reused buffer. Each request type is checked
+ * to serialize to the same JSON both ways, then timed with its allocations counted.
+ *
+ * Runs offline, only building the request is timed.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "spiceapi/request_writer.h"
+#include "rapidjson/document.h"
+#include "rapidjson/writer.h"
+#include "tools/alloc_counter.h"
+#include "tools/bench.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace spiceapi;
+using namespace rapidjson;
+
+namespace {
+
+    struct Options {
+        int time_ms = 500;
+    };
+
+    Options options;
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --time <ms>           how long to run each benchmark (default 500)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--time")
+                options.time_ms = atoi(value.c_str());
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // the old wrappers' helpers, unchanged
+    std::string doc2str(Document &doc) {
+        StringBuffer sb;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+        doc.Accept(writer);
+        return sb.GetString();
+    }
+
+    Document request_gen(const char *module, const char *function) {
+
+        // create document
+        Document doc;
+        doc.SetObject();
+
+        // add attributes
+        auto &alloc = doc.GetAllocator();
+        doc.AddMember("id", msg_gen_id(), alloc);
+        doc.AddMember("module", StringRef(module), alloc);
+        doc.AddMember("function", StringRef(function), alloc);
+
+        // add params
+        Value noparam(kArrayType);
+        doc.AddMember("params", noparam, alloc);
+
+        // return document
+        return doc;
+    }
+
+    // the arguments, like the program passes them
+    struct Arguments {
+        std::vector<ButtonState> buttons;
+        std::vector<LightState> lights;
+        std::vector<TouchState> touches;
+        std::vector<char> keys = { '1', '2', '3', '4' };
+        const char *card_id = "E004010000000000";
+
+        Arguments() {
+            for (size_t button = 0; button < BUTTON_COUNT; button++)
+                this->buttons.push_back({ std::string(BUTTON_NAMES.name(button)), (float) (button % 2) });
+            for (size_t light = 0; light < 10; light++)
+                this->lights.push_back({ std::string(LIGHT_NAMES.name(light)), 0.5f });
+            this->touches.push_back({ 0, 100, 200 });
+            this->touches.push_back({ 1, 1820, 960 });
+        }
+    };
+
+    Arguments args;
+    RequestWriter writer;
+
+    /*
+     * One request type: how the old wrapper built it, and how the current one does.
+     */
+    struct Case {
+        const char *name;
+        std::string (*before)();
+        std::string_view (*after)();
+    };
+
+    const Case CASES[] = {
+        {
+            "buttons write (18)",
+            []() {
+                auto req = request_gen("buttons", "write");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                for (auto &state : args.buttons) {
+                    Value state_val(kArrayType);
+                    state_val.PushBack(StringRef(state.name.c_str()), alloc);
+                    state_val.PushBack(state.value, alloc);
+                    params.PushBack(state_val, alloc);
+                }
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("buttons", "write", [](RequestWriter &writer) {
+                    for (auto &state : args.buttons)
+                        writer.array(state.name, state.value);
+                });
+            },
+        },
+        {
+            "keypads set",
+            []() {
+                auto req = request_gen("keypads", "set");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                params.PushBack(0u, alloc);
+                for (auto &key : args.keys)
+                    params.PushBack(StringRef(&key, 1), alloc);
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("keypads", "set", 0u, [](RequestWriter &writer) {
+                    for (auto &key : args.keys)
+                        writer.value(std::string_view(&key, 1));
+                });
+            },
+        },
+        {
+            "card insert",
+            []() {
+                auto req = request_gen("card", "insert");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                params.PushBack((uint64_t) 0, alloc);
+                params.PushBack(StringRef(args.card_id), alloc);
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("card", "insert", (size_t) 0, args.card_id);
+            },
+        },
+        {
+            "lights read",
+            []() {
+                auto req = request_gen("lights", "read");
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("lights", "read");
+            },
+        },
+        {
+            "lights write (10)",
+            []() {
+                auto req = request_gen("lights", "write");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                for (auto &state : args.lights) {
+                    Value state_val(kArrayType);
+                    state_val.PushBack(StringRef(state.name.c_str()), alloc);
+                    state_val.PushBack(state.value, alloc);
+                    params.PushBack(state_val, alloc);
+                }
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("lights", "write", [](RequestWriter &writer) {
+                    for (auto &state : args.lights)
+                        writer.array(state.name, state.value);
+                });
+            },
+        },
+        {
+            "touch write (2)",
+            []() {
+                auto req = request_gen("touch", "write");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                for (auto &state : args.touches) {
+                    Value state_val(kArrayType);
+                    state_val.PushBack(state.id, alloc);
+                    state_val.PushBack(state.x, alloc);
+                    state_val.PushBack(state.y, alloc);
+                    params.PushBack(state_val, alloc);
+                }
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("touch", "write", [](RequestWriter &writer) {
+                    for (auto &state : args.touches)
+                        writer.array(state.id, state.x, state.y);
+                });
+            },
+        },
+        {
+            "coin insert",
+            []() {
+                auto req = request_gen("coin", "insert");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                params.PushBack(1, alloc);
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("coin", "insert", 1);
+            },
+        },
+        {
+            "control raise",
+            []() {
+                auto req = request_gen("control", "raise");
+                auto &alloc = req.GetAllocator();
+                Value params(kArrayType);
+                params.PushBack(StringRef("SIGINT"), alloc);
+                req["params"] = params;
+                return doc2str(req);
+            },
+            []() {
+                return writer.build("control", "raise", "SIGINT");
+            },
+        },
+    };
+
+    // same JSON apart from the message ID, which is new for every request
+    bool same_request(std::string_view a, std::string_view b) {
+        Document doc_a, doc_b;
+        doc_a.Parse(a.data(), a.length());
+        doc_b.Parse(b.data(), b.length());
+        if (doc_a.HasParseError() || doc_b.HasParseError() || !doc_a.IsObject() || !doc_b.IsObject()
+                || !doc_a.HasMember("id") || !doc_b.HasMember("id"))
+            return false;
+        doc_a["id"] = 0;
+        doc_b["id"] = 0;
+        return doc_a == doc_b;
+    }
+
+    template<typename Op>
+    double allocations_per_op(Op &&op) {
+        const int count = 1000;
+        auto allocations = alloc_counter::counted([&]() {
+            for (int i = 0; i < count; i++)
+                bench::sink = bench::sink + op();
+        });
+        return (double) allocations / count;
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    // both have to send the same thing for the comparison to mean anything
+    for (auto &test : CASES) {
+        std::string before = test.before();
+        std::string after(test.after());
+        if (!same_request(before, after)) {
+            fprintf(stderr, "%s: requests differ:\n%s\n%s\n", test.name, before.c_str(), after.c_str());
+            return 1;
+        }
+    }
+    printf("requests match\n");
+
+    printf("%-20s %12s %8s %12s %8s %8s\n", "", "DOM ns", "allocs", "writer ns", "allocs", "speedup");
+    for (auto &test : CASES) {
+        auto before = [&test]() { return (uint64_t) test.before().length(); };
+        auto after = [&test]() { return (uint64_t) test.after().length(); };
+        double before_ns = bench::ns_per_op(before, options.time_ms);
+        double after_ns = bench::ns_per_op(after, options.time_ms);
+        printf("%-20s %12.0f %8.1f %12.0f %8.1f %7.1fx\n",
+                test.name,
+                before_ns, allocations_per_op(before),
+                after_ns, allocations_per_op(after),
+                before_ns / after_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * Loopback SpiceAPI stand-in server, for load and latency testing without the game.
+ *
+ * Speaks the same framing as spice2x (null-terminated JSON, RC4 with the password if one is set), and
+ * implements the modules SpiceManiaX uses: buttons, keypads, card, lights, ddr tapeled_get and coin get
+ * (the health probe). Payloads are roughly the size of the real ones, and the lights animate in one of
+ * a few patterns. Every response can be delayed by a fixed latency plus random jitter.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "spiceapi/names.h"
+#include "spiceapi/rc4.h"
+#include "spiceapi/socket.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    enum Pattern {
+        PATTERN_OFF,
+        PATTERN_ON,
+        PATTERN_PULSE,
+        PATTERN_CHASE,
+        PATTERN_RANDOM
+    };
+
+    struct Options {
+        uint16_t port = 1337;
+        std::string unix_path;
+        std::string password = "spicemaniax";
+        int latency_us = 0;
+        int jitter_us = 0;
+        Pattern pattern = PATTERN_PULSE;
+        int period_ms = 1000;
+        int stats_interval_ms = 5000;
+        int read_max = 0;
+        bool help = false;
+    };
+
+    Options options;
+    std::chrono::steady_clock::time_point start_time;
+
+    // counters over all clients
+    std::atomic<uint64_t> stat_connections{0};
+    std::atomic<uint64_t> stat_requests{0};
+    std::atomic<uint64_t> stat_errors{0};
+    std::atomic<uint64_t> stat_bytes_in{0};
+    std::atomic<uint64_t> stat_bytes_out{0};
+
+    /*
+     * Roughly the set of lights spice2x reports for DDR, the gold cabinet ones SpiceManiaX reads are
+     * mixed in with the rest like in a real response.
+     */
+    const char *const EXTRA_LIGHTS[] = {
+        "P1 Foot Up", "P1 Foot Down", "P1 Foot Left", "P1 Foot Right",
+        "P2 Foot Up", "P2 Foot Down", "P2 Foot Left", "P2 Foot Right",
+        "Spot Red", "Spot Blue", "Top Spot Red", "Top Spot Blue",
+        "P1 Halogen Upper", "P1 Halogen Lower", "P2 Halogen Upper", "P2 Halogen Lower",
+        "P1 Button", "P2 Button", "Neon",
+        "HD P1 Start", "HD P1 Menu Left-Right", "HD P1 Menu Up-Down",
+        "HD P2 Start", "HD P2 Menu Left-Right", "HD P2 Menu Up-Down",
+        "HD P1 Speaker F R", "HD P1 Speaker F G", "HD P1 Speaker F B",
+        "HD P2 Speaker F R", "HD P2 Speaker F G", "HD P2 Speaker F B",
+        "GOLD P1 Menu Start", "GOLD P1 Menu Up", "GOLD P1 Menu Down", "GOLD P1 Menu Left", "GOLD P1 Menu Right",
+        "GOLD P2 Menu Start", "GOLD P2 Menu Up", "GOLD P2 Menu Down", "GOLD P2 Menu Left", "GOLD P2 Menu Right",
+    };
+
+    bool parse_pattern(const std::string &name, Pattern &pattern) {
+        if (name == "off")
+            pattern = PATTERN_OFF;
+        else if (name == "on")
+            pattern = PATTERN_ON;
+        else if (name == "pulse")
+            pattern = PATTERN_PULSE;
+        else if (name == "chase")
+            pattern = PATTERN_CHASE;
+        else if (name == "random")
+            pattern = PATTERN_RANDOM;
+        else
+            return false;
+        return true;
+    }
+
+    /*
+     * Brightness in [0, 1] of the light at `index` out of `count`, at the current time.
+     */
+    float pattern_value(size_t index, size_t count, std::minstd_rand &random) {
+        double t = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start_time).count() / options.period_ms;
+        switch (options.pattern) {
+            case PATTERN_ON:
+                return 1.f;
+            case PATTERN_PULSE:
+                return (float) (0.5 + 0.5 * std::sin(t * 2.0 * 3.14159265358979));
+            case PATTERN_CHASE:
+                return (size_t) (t * count) % count == index ? 1.f : 0.f;
+            case PATTERN_RANDOM:
+                return (random() & 1) ? 1.f : 0.f;
+            case PATTERN_OFF:
+            default:
+                return 0.f;
+        }
+    }
+
+    typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
+
+    void write_lights(JsonWriter &writer, std::minstd_rand &random) {
+        size_t count = LIGHT_COUNT + std::size(EXTRA_LIGHTS);
+        size_t index = 0;
+        for (const char *name : EXTRA_LIGHTS) {
+            writer.StartArray();
+            writer.String(name);
+            writer.Double(pattern_value(index++, count, random));
+            writer.EndArray();
+        }
+        for (size_t light = 0; light < LIGHT_COUNT; light++) {
+            writer.StartArray();
+            writer.String(LIGHT_NAMES.c_str(light), (rapidjson::SizeType) LIGHT_NAMES.name(light).length());
+            writer.Double(pattern_value(index++, count, random));
+            writer.EndArray();
+        }
+    }
+
+    void write_tapeleds(JsonWriter &writer, std::minstd_rand &random) {
+        writer.StartObject();
+        for (size_t device = 0; device < TAPELED_COUNT; device++) {
+            size_t led_count = device == TAPELED_TOP_PANEL ? 40 : 25;
+            writer.Key(TAPELED_NAMES.c_str(device), (rapidjson::SizeType) TAPELED_NAMES.name(device).length());
+            writer.StartArray();
+            for (size_t led = 0; led < led_count; led++) {
+                auto value = (unsigned) (pattern_value(led, led_count, random) * 255.f);
+                writer.Uint(value);
+                writer.Uint(device % 2 ? 0 : value);
+                writer.Uint(device % 2 ? value : 0);
+            }
+            writer.EndArray();
+        }
+        writer.EndObject();
+    }
+
+    /*
+     * Builds the response for one request. Requests we don't know get an error, like spice2x does.
+     */
+    void handle_request(const char *json, std::string &response, std::minstd_rand &random) {
+        rapidjson::Document req;
+        req.Parse(json);
+
+        rapidjson::StringBuffer buffer;
+        JsonWriter writer(buffer);
+        writer.StartObject();
+        writer.Key("id");
+        if (!req.HasParseError() && req.IsObject() && req.HasMember("id") && req["id"].IsUint64())
+            writer.Uint64(req["id"].GetUint64());
+        else
+            writer.Uint64(0);
+
+        // look up the function
+        std::string_view module, function;
+        if (!req.HasParseError() && req.IsObject()
+                && req.HasMember("module") && req["module"].IsString()
+                && req.HasMember("function") && req["function"].IsString()) {
+            module = std::string_view(req["module"].GetString(), req["module"].GetStringLength());
+            function = std::string_view(req["function"].GetString(), req["function"].GetStringLength());
+        }
+
+        // data
+        const char *error = nullptr;
+        writer.Key("errors");
+        writer.StartArray();
+        if (module.empty()) {
+            error = "invalid request";
+        } else if (module == "buttons" && function != "read" && function != "write" && function != "write_reset") {
+            error = "unknown function";
+        } else if (module == "keypads" && function != "write" && function != "set" && function != "get") {
+            error = "unknown function";
+        } else if (module == "card" && function != "insert") {
+            error = "unknown function";
+        } else if (module == "lights" && function != "read" && function != "write" && function != "write_reset") {
+            error = "unknown function";
+        } else if (module == "ddr" && function != "tapeled_get") {
+            error = "unknown function";
+        } else if (module == "coin" && function != "get") {
+            error = "unknown function";
+        } else if (module != "buttons" && module != "keypads" && module != "card"
+                && module != "lights" && module != "ddr" && module != "coin") {
+            error = "unknown module";
+        }
+
+        // inputs are accepted and dropped
+        if (error != nullptr) {
+            writer.String(error);
+            stat_errors++;
+        }
+        writer.EndArray();
+
+        writer.Key("data");
+        writer.StartArray();
+        if (error == nullptr && module == "lights" && function == "read")
+            write_lights(writer, random);
+        else if (error == nullptr && module == "ddr")
+            write_tapeleds(writer, random);
+        else if (error == nullptr && module == "coin")
+            writer.Int(0);
+        writer.EndArray();
+        writer.EndObject();
+
+        response.assign(buffer.GetString(), buffer.GetSize());
+        response.push_back('\0');
+    }
+
+    bool send_all(socket_t sock, const char *data, size_t size) {
+        while (size > 0) {
+            int result = socket_send(sock, data, size);
+            if (result <= 0)
+                return false;
+            data += result;
+            size -= result;
+        }
+        return true;
+    }
+
+    /*
+     * Serves one client until it disconnects. Requests are answered in order, the RC4 state is shared by
+     * both directions like on the real server.
+     */
+    void serve_client(socket_t sock) {
+        std::unique_ptr<RC4> cipher;
+        if (!options.password.empty())
+            cipher = std::make_unique<RC4>((uint8_t *) options.password.c_str(), options.password.length());
+        std::minstd_rand random(std::random_device{}());
+        std::uniform_int_distribution<int> jitter(-options.jitter_us, options.jitter_us);
+
+        std::vector<char> buffer;
+        size_t buffer_end = 0;
+        std::string response;
+        while (true) {
+
+            // receive, in small pieces if asked to so pipelined batches get split up
+            if (buffer.size() < buffer_end + 4096)
+                buffer.resize(buffer_end + 4096);
+            size_t read_size = buffer.size() - buffer_end;
+            if (options.read_max > 0)
+                read_size = (std::min)(read_size, (size_t) options.read_max);
+            int received = socket_receive(sock, &buffer[buffer_end], read_size);
+            if (received <= 0)
+                break;
+            if (cipher)
+                cipher->crypt((uint8_t *) &buffer[buffer_end], (size_t) received);
+            buffer_end += received;
+            stat_bytes_in += received;
+
+            // answer every complete request
+            size_t start = 0;
+            bool ok = true;
+            while (ok) {
+                auto end = (const char *) memchr(&buffer[start], 0, buffer_end - start);
+                if (end == nullptr)
+                    break;
+                handle_request(&buffer[start], response, random);
+                start = end - buffer.data() + 1;
+                stat_requests++;
+
+                // simulated latency
+                int delay_us = options.latency_us + (options.jitter_us > 0 ? jitter(random) : 0);
+                if (delay_us > 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+
+                if (cipher)
+                    cipher->crypt((uint8_t *) response.data(), response.size());
+                ok = send_all(sock, response.data(), response.size());
+                stat_bytes_out += response.size();
+            }
+            if (!ok)
+                break;
+
+            // keep the partial request
+            memmove(buffer.data(), &buffer[start], buffer_end - start);
+            buffer_end -= start;
+        }
+
+        socket_close(sock);
+    }
+
+    void print_stats() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.stats_interval_ms));
+            printf("connections: %llu, requests: %llu, errors: %llu, bytes in: %llu, bytes out: %llu\n",
+                    (unsigned long long) stat_connections,
+                    (unsigned long long) stat_requests,
+                    (unsigned long long) stat_errors,
+                    (unsigned long long) stat_bytes_in,
+                    (unsigned long long) stat_bytes_out);
+            fflush(stdout);
+        }
+    }
+
+    void usage(const char *name) {
+        printf("usage: %s [options]\n"
+               "  --port <port>         TCP port to listen on (default 1337)\n"
+               "  --unix <path>         listen on a Unix domain socket instead\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --latency <us>        delay before every response, in microseconds (default 0)\n"
+               "  --jitter <us>         random +/- delay added to the latency (default 0)\n"
+               "  --pattern <name>      lights pattern: off, on, pulse, chase, random (default pulse)\n"
+               "  --period <ms>         length of one pattern cycle (default 1000)\n"
+               "  --stats <ms>          interval for printing counters, 0 to disable (default 5000)\n"
+               "  --read-max <bytes>    read at most this much per receive, 0 for no limit (default 0)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                options.help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--unix")
+                options.unix_path = value;
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--latency")
+                options.latency_us = atoi(value.c_str());
+            else if (arg == "--jitter")
+                options.jitter_us = atoi(value.c_str());
+            else if (arg == "--pattern") {
+                if (!parse_pattern(value, options.pattern))
+                    return false;
+            } else if (arg == "--period")
+                options.period_ms = (std::max)(atoi(value.c_str()), 1);
+            else if (arg == "--stats")
+                options.stats_interval_ms = atoi(value.c_str());
+            else if (arg == "--read-max")
+                options.read_max = atoi(value.c_str());
+            else
+                return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv) || options.help) {
+        usage(argv[0]);
+        return options.help ? 0 : 1;
+    }
+    if (!socket_startup()) {
+        fprintf(stderr, "failed to start sockets: %d\n", socket_error());
+        return 1;
+    }
+    start_time = std::chrono::steady_clock::now();
+
+    // listen
+    socket_t server;
+    if (!options.unix_path.empty()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (options.unix_path.length() >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "unix socket path too long\n");
+            return 1;
+        }
+        memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.length() + 1);
+#ifdef _WIN32
+        DeleteFileA(options.unix_path.c_str());
+#else
+        unlink(options.unix_path.c_str());
+#endif
+        server = socket_open(AF_UNIX, SOCK_STREAM, 0);
+        if (server == SOCKET_INVALID || bind(server, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "failed to bind %s: %d\n", options.unix_path.c_str(), socket_error());
+            return 1;
+        }
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(options.port);
+        server = socket_open(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int reuse = 1;
+        if (server != SOCKET_INVALID)
+            setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+        if (server == SOCKET_INVALID || bind(server, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "failed to bind port %u: %d\n", options.port, socket_error());
+            return 1;
+        }
+    }
+    if (listen(server, 16) != 0) {
+        fprintf(stderr, "listen failed: %d\n", socket_error());
+        return 1;
+    }
+    printf("listening on %s\n", options.unix_path.empty()
+            ? ("127.0.0.1:" + std::to_string(options.port)).c_str() : options.unix_path.c_str());
+    fflush(stdout);
+
+    if (options.stats_interval_ms > 0)
+        std::thread(print_stats).detach();
+
+    // one thread per client
+    while (true) {
+        socket_t client = accept(server, nullptr, nullptr);
+        if (client == SOCKET_INVALID)
+            continue;
+        if (options.unix_path.empty())
+            socket_set_nodelay(client, true);
+        stat_connections++;
+        std::thread(serve_client, client).detach();
+    }
+}
@@ -0,0 +1,370 @@
+/*
+ * Replays a SpiceAPI capture (see spiceapi/capture.h, recorded with SpiceManiaX --capture).
+ *
+ * With --info it summarizes the capture per request type: message counts, payload sizes and response
+ * latencies. Otherwise it serves the capture: it listens like the game does, and answers every request
+ * with the next recorded response of the same module and function, so the client and the lights
+ * pipeline run on real data. Responses go out as fast as possible, or with --timing original after the
+ * latency they originally had.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "rapidjson/document.h"
+#include "spiceapi/capture.h"
+#include "spiceapi/rc4.h"
+#include "spiceapi/socket.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        std::string capture_path;
+        bool info = false;
+        uint16_t port = 1337;
+        std::string unix_path;
+        std::string password = "spicemaniax";
+        bool original_timing = false;
+    };
+
+    // a recorded response, with where its ID sits so it can be swapped for the one being answered
+    struct Response {
+        std::string_view data;
+        size_t id_begin = 0;
+        size_t id_end = 0;
+        uint64_t latency_ns = 0;
+    };
+
+    // all recorded responses to one module and function, in capture order
+    struct Kind {
+        uint64_t requests = 0;
+        uint64_t response_bytes_max = 0;
+        uint64_t response_bytes = 0;
+        uint64_t latency_ns_max = 0;
+        std::vector<Response> responses;
+    };
+
+    Options options;
+    CaptureReader capture;
+    std::map<std::string, Kind> kinds;
+
+    struct RequestInfo {
+        uint64_t id = 0;
+        std::string kind;
+    };
+
+    bool parse_request(std::string_view json, RequestInfo &info) {
+        rapidjson::Document doc;
+        doc.Parse(json.data(), json.length());
+        if (doc.HasParseError() || !doc.IsObject()
+                || !doc.HasMember("id") || !doc["id"].IsUint64()
+                || !doc.HasMember("module") || !doc["module"].IsString()
+                || !doc.HasMember("function") || !doc["function"].IsString())
+            return false;
+        info.id = doc["id"].GetUint64();
+        info.kind = std::string(doc["module"].GetString()) + " " + doc["function"].GetString();
+        return true;
+    }
+
+    /*
+     * Finds the digits of the ID in a response. Both spice2x and our writer put it first, so only the
+     * start of the message is searched.
+     */
+    bool find_response_id(std::string_view json, size_t &begin, size_t &end, uint64_t &id) {
+        auto key = json.substr(0, 32).find("\"id\"");
+        if (key == std::string_view::npos)
+            return false;
+        size_t pos = key + 4;
+        while (pos < json.length() && (json[pos] == ' ' || json[pos] == ':'))
+            pos++;
+        begin = pos;
+        id = 0;
+        while (pos < json.length() && json[pos] >= '0' && json[pos] <= '9')
+            id = id * 10 + (json[pos++] - '0');
+        end = pos;
+        return end > begin;
+    }
+
+    /*
+     * Walks the capture once, pairing every response with its request by channel and ID.
+     */
+    bool load_capture() {
+        if (!capture.open(options.capture_path)) {
+            fprintf(stderr, "unable to open capture %s\n", options.capture_path.c_str());
+            return false;
+        }
+
+        struct Pending {
+            std::string kind;
+            uint64_t time_ns;
+        };
+        std::unordered_map<uint64_t, Pending> pending[256];
+        uint64_t records = 0, unmatched = 0, last_time_ns = 0;
+        CaptureRecord record;
+        while (capture.next(record)) {
+            records++;
+            last_time_ns = record.time_ns;
+            if (record.direction == CAPTURE_REQUEST) {
+                RequestInfo info;
+                if (!parse_request(record.data, info))
+                    continue;
+                auto &kind = kinds[info.kind];
+                kind.requests++;
+                pending[record.channel][info.id] = Pending{info.kind, record.time_ns};
+            } else {
+                Response response;
+                uint64_t id;
+                auto &channel = pending[record.channel];
+                auto request = channel.end();
+                if (find_response_id(record.data, response.id_begin, response.id_end, id))
+                    request = channel.find(id);
+                if (request == channel.end()) {
+                    unmatched++;
+                    continue;
+                }
+                response.data = record.data;
+                response.latency_ns = record.time_ns - request->second.time_ns;
+                auto &kind = kinds[request->second.kind];
+                kind.response_bytes += record.data.length();
+                kind.response_bytes_max = (std::max)(kind.response_bytes_max, (uint64_t) record.data.length());
+                kind.latency_ns_max = (std::max)(kind.latency_ns_max, response.latency_ns);
+                kind.responses.push_back(response);
+                channel.erase(request);
+            }
+        }
+
+        printf("%llu records over %.3fs, %llu responses without a request\n",
+                (unsigned long long) records, last_time_ns / 1e9, (unsigned long long) unmatched);
+        return true;
+    }
+
+    void print_info() {
+        printf("%-24s %10s %10s %12s %12s %12s %12s\n",
+                "request", "requests", "responses", "avg bytes", "max bytes", "avg latency", "max latency");
+        for (auto &entry : kinds) {
+            auto &kind = entry.second;
+            uint64_t latency_total = 0;
+            for (auto &response : kind.responses)
+                latency_total += response.latency_ns;
+            size_t count = kind.responses.size();
+            printf("%-24s %10llu %10zu %12llu %12llu %10.1fus %10.1fus\n",
+                    entry.first.c_str(),
+                    (unsigned long long) kind.requests,
+                    count,
+                    (unsigned long long) (count > 0 ? kind.response_bytes / count : 0),
+                    (unsigned long long) kind.response_bytes_max,
+                    count > 0 ? latency_total / 1e3 / count : 0.0,
+                    kind.latency_ns_max / 1e3);
+        }
+    }
+
+    bool send_all(socket_t sock, const char *data, size_t size) {
+        while (size > 0) {
+            int result = socket_send(sock, data, size);
+            if (result <= 0)
+                return false;
+            data += result;
+            size -= result;
+        }
+        return true;
+    }
+
+    /*
+     * Builds the answer to one request from the next recorded response of its kind, looping around at
+     * the end. Requests the capture has no responses for get an empty success.
+     */
+    uint64_t build_response(const char *json, std::unordered_map<std::string, size_t> &cursors,
+            std::string &out) {
+        RequestInfo info;
+        bool valid = parse_request(json, info);
+        auto id = std::to_string(valid ? info.id : 0);
+
+        auto kind = valid ? kinds.find(info.kind) : kinds.end();
+        if (kind == kinds.end() || kind->second.responses.empty()) {
+            out = "{\"id\":" + id + ",\"errors\":[],\"data\":[]}";
+            out.push_back('\0');
+            return 0;
+        }
+
+        auto &responses = kind->second.responses;
+        auto &cursor = cursors[info.kind];
+        auto &response = responses[cursor];
+        cursor = (cursor + 1) % responses.size();
+
+        out.assign(response.data.data(), response.id_begin);
+        out.append(id);
+        out.append(response.data.data() + response.id_end, response.data.length() - response.id_end);
+        out.push_back('\0');
+        return response.latency_ns;
+    }
+
+    void serve_client(socket_t sock) {
+        RC4 *cipher = nullptr;
+        if (!options.password.empty())
+            cipher = new RC4((uint8_t *) options.password.c_str(), options.password.length());
+
+        std::unordered_map<std::string, size_t> cursors;
+        std::vector<char> buffer;
+        size_t buffer_end = 0;
+        std::string response;
+        bool ok = true;
+        while (ok) {
+
+            // receive
+            if (buffer.size() < buffer_end + 4096)
+                buffer.resize(buffer_end + 4096);
+            int received = socket_receive(sock, &buffer[buffer_end], buffer.size() - buffer_end);
+            if (received <= 0)
+                break;
+            if (cipher != nullptr)
+                cipher->crypt((uint8_t *) &buffer[buffer_end], (size_t) received);
+            buffer_end += received;
+
+            // answer every complete request
+            size_t start = 0;
+            while (ok) {
+                auto end = (const char *) memchr(&buffer[start], 0, buffer_end - start);
+                if (end == nullptr)
+                    break;
+                uint64_t latency_ns = build_response(&buffer[start], cursors, response);
+                start = end - buffer.data() + 1;
+                if (options.original_timing && latency_ns > 0)
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(latency_ns));
+                if (cipher != nullptr)
+                    cipher->crypt((uint8_t *) response.data(), response.size());
+                ok = send_all(sock, response.data(), response.size());
+            }
+
+            // keep the partial request
+            memmove(buffer.data(), &buffer[start], buffer_end - start);
+            buffer_end -= start;
+        }
+
+        socket_close(sock);
+        delete cipher;
+    }
+
+    socket_t listen_socket() {
+        socket_t server;
+        if (!options.unix_path.empty()) {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (options.unix_path.length() >= sizeof(addr.sun_path))
+                return SOCKET_INVALID;
+            memcpy(addr.sun_path, options.unix_path.c_str(), options.unix_path.length() + 1);
+#ifdef _WIN32
+            DeleteFileA(options.unix_path.c_str());
+#else
+            unlink(options.unix_path.c_str());
+#endif
+            server = socket_open(AF_UNIX, SOCK_STREAM, 0);
+            if (server == SOCKET_INVALID || bind(server, (const sockaddr *) &addr, sizeof(addr)) != 0)
+                return SOCKET_INVALID;
+        } else {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(options.port);
+            server = socket_open(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            int reuse = 1;
+            if (server != SOCKET_INVALID)
+                setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+            if (server == SOCKET_INVALID || bind(server, (const sockaddr *) &addr, sizeof(addr)) != 0)
+                return SOCKET_INVALID;
+        }
+        if (listen(server, 16) != 0)
+            return SOCKET_INVALID;
+        return server;
+    }
+
+    void usage(const char *name) {
+        printf("usage: %s <capture> [options]\n"
+               "  --info                print a summary of the capture and exit\n"
+               "  --port <port>         TCP port to listen on (default 1337)\n"
+               "  --unix <path>         listen on a Unix domain socket instead\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --timing <mode>       fast, or original to delay responses like in the capture (default fast)\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv) {
+        if (argc < 2 || argv[1][0] == '-')
+            return false;
+        options.capture_path = argv[1];
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--info") {
+                options.info = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--unix")
+                options.unix_path = value;
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--timing" && (value == "fast" || value == "original"))
+                options.original_timing = value == "original";
+            else
+                return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!load_capture())
+        return 1;
+    if (options.info) {
+        print_info();
+        return 0;
+    }
+
+    // serve
+    if (!socket_startup()) {
+        fprintf(stderr, "failed to start sockets: %d\n", socket_error());
+        return 1;
+    }
+    socket_t server = listen_socket();
+    if (server == SOCKET_INVALID) {
+        fprintf(stderr, "failed to listen: %d\n", socket_error());
+        return 1;
+    }
+    printf("replaying on %s\n", options.unix_path.empty()
+            ? ("127.0.0.1:" + std::to_string(options.port)).c_str() : options.unix_path.c_str());
+    fflush(stdout);
+
+    while (true) {
+        socket_t client = accept(server, nullptr, nullptr);
+        if (client == SOCKET_INVALID)
+            continue;
+        if (options.unix_path.empty())
+            socket_set_nodelay(client, true);
+        std::thread(serve_client, client).detach();
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * Compares SpiceAPI round trips over TCP loopback against a Unix domain socket. It sends the buttons write
+ * request the input worker sends at 1000Hz, back to back over each transport, and reports the round trip
+ * latency plus the CPU time this process spends per message.
+ *
+ * Needs a server listening on both, usually tools/spiceapi_emu started once with --port and once with
+ * --unix. The server's own CPU time isn't included.
+ *
+ * Builds on Linux and Windows, see the README.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "spiceapi/wrappers.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace spiceapi;
+
+namespace {
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        uint16_t port = 1337;
+        std::string unix_path;
+        std::string password = "spicemaniax";
+        int count = 20000;
+        int warmup = 1000;
+    };
+
+    Options options;
+
+    void usage(const char *name) {
+        printf("usage: %s --unix <path> [options]\n"
+               "  --host <host>         SpiceAPI TCP host (default 127.0.0.1)\n"
+               "  --port <port>         SpiceAPI TCP port (default 1337)\n"
+               "  --unix <path>         SpiceAPI Unix domain socket path\n"
+               "  --password <pass>     RC4 password, empty for none (default spicemaniax)\n"
+               "  --count <count>       round trips per transport (default 20000)\n"
+               "  --warmup <count>      round trips to run first, not measured (default 1000)\n"
+               "  --help                print this help and exit\n",
+               name);
+    }
+
+    bool parse_args(int argc, char **argv, bool &help) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                help = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--host")
+                options.host = value;
+            else if (arg == "--port")
+                options.port = (uint16_t) atoi(value.c_str());
+            else if (arg == "--unix")
+                options.unix_path = value;
+            else if (arg == "--password")
+                options.password = value;
+            else if (arg == "--count")
+                options.count = atoi(value.c_str());
+            else if (arg == "--warmup")
+                options.warmup = atoi(value.c_str());
+            else
+                return false;
+        }
+        return !options.unix_path.empty();
+    }
+
+    // CPU time used by this process so far, user and kernel, in nanoseconds
+    uint64_t cpu_time_ns() {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+            return 0;
+        auto ticks = [](const FILETIME &time) {
+            return ((uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime;
+        };
+        return (ticks(kernel) + ticks(user)) * 100;
+#else
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        auto ns = [](const timeval &time) {
+            return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_usec * 1000ull;
+        };
+        return ns(usage.ru_utime) + ns(usage.ru_stime);
+#endif
+    }
+
+    bool run(const char *name, const std::string &host, uint16_t port) {
+        Connection con(host, port, options.password);
+        if (!con.check()) {
+            fprintf(stderr, "%s: unable to connect\n", name);
+            return false;
+        }
+
+        // flip a panel every round trip so it's a real request
+        ButtonsWriteRequest request;
+        for (int i = 0; i < options.warmup; i++) {
+            request.set(BUTTON_P1_PANEL_UP, i % 2 == 0);
+            if (!buttons_write(con, request)) {
+                fprintf(stderr, "%s: request failed during warmup\n", name);
+                return false;
+            }
+        }
+
+        LatencyHistogram latency;
+        uint64_t failures = 0;
+        uint64_t cpu_start = cpu_time_ns();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.count; i++) {
+            request.set(BUTTON_P1_PANEL_UP, i % 2 == 0);
+            auto sent = std::chrono::steady_clock::now();
+            if (!buttons_write(con, request))
+                failures++;
+            latency.record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - sent).count());
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t cpu = cpu_time_ns() - cpu_start;
+
+        printf("%-6s %6.1f us mean, %6.1f us p50, %6.1f us p99, %7.1f us max, %6.1f us CPU/msg, %8.0f msg/s",
+                name,
+                latency.mean() / 1000.0,
+                latency.percentile(50) / 1000.0,
+                latency.percentile(99) / 1000.0,
+                latency.max_value() / 1000.0,
+                (double) cpu / options.count / 1000.0,
+                options.count / std::chrono::duration<double>(elapsed).count());
+        if (failures > 0)
+            printf(", %llu failed", (unsigned long long) failures);
+        printf("\n");
+        return failures == 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    bool help = false;
+    if (!parse_args(argc, argv, help) || help) {
+        usage(argv[0]);
+        return help ? 0 : 1;
+    }
+
+    bool ok = run("tcp", options.host, options.port);
+    ok = run("unix", "unix:" + options.unix_path, options.port) && ok;
+    return ok ? 0 : 2;
+}